@@ -1,10 +1,30 @@
+#include <atomic>
+#include <optional>
 #include <benchmark/benchmark.h>
 #include <async/mutex.hpp>
+#include <async/distributed-shared-mutex.hpp>
+
+#include "../tests/flag-receiver.hpp"
+
+namespace {
+
+template<typename Mutex>
+void contended_lock(benchmark::State& state, Mutex &m) {
+	static uint64_t counter = 0;
+	std::atomic<bool> locked;
+	for (auto _ : state) {
+		wait_blocking(m.async_lock(), locked);
+		benchmark::DoNotOptimize(++counter);
+		m.unlock();
+	}
+}
+
+} // anonymous namespace
 
 static void BM_TryLock_Mutex(benchmark::State& state) {
 	async::mutex m;
 	for (auto _ : state) {
-		auto success = m.try_lock();
+		[[maybe_unused]] auto success = m.try_lock();
 		assert(success);
 		m.unlock();
 	}
@@ -14,7 +34,7 @@ BENCHMARK(BM_TryLock_Mutex);
 static void BM_TryLock_SharedMutex(benchmark::State& state) {
 	async::shared_mutex m;
 	for (auto _ : state) {
-		auto success = m.try_lock();
+		[[maybe_unused]] auto success = m.try_lock();
 		assert(success);
 		m.unlock();
 	}
@@ -24,9 +44,66 @@ BENCHMARK(BM_TryLock_SharedMutex);
 static void BM_TryLockShared_SharedMutex(benchmark::State& state) {
 	async::shared_mutex m;
 	for (auto _ : state) {
-		auto success = m.try_lock_shared();
+		[[maybe_unused]] auto success = m.try_lock_shared();
 		assert(success);
 		m.unlock_shared();
 	}
 }
 BENCHMARK(BM_TryLockShared_SharedMutex);
+
+static void BM_TryLockShared_Parallel_SharedMutex(benchmark::State& state) {
+	static async::shared_mutex m;
+	for (auto _ : state) {
+		[[maybe_unused]] auto success = m.try_lock_shared();
+		assert(success);
+		m.unlock_shared();
+	}
+}
+BENCHMARK(BM_TryLockShared_Parallel_SharedMutex)->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
+
+static void BM_TryLockShared_Parallel_DistributedSharedMutex(benchmark::State& state) {
+	static async::distributed_shared_mutex<> m;
+	for (auto _ : state) {
+		[[maybe_unused]] auto success = m.try_lock_shared();
+		assert(success);
+		m.unlock_shared();
+	}
+}
+BENCHMARK(BM_TryLockShared_Parallel_DistributedSharedMutex)->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
+
+static void BM_AsyncLock_Contended_Mutex(benchmark::State& state) {
+	static async::mutex m;
+	contended_lock(state, m);
+}
+BENCHMARK(BM_AsyncLock_Contended_Mutex)->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
+
+static void BM_AsyncLock_Contended_AdaptiveMutex(benchmark::State& state) {
+	static async::mutex m{{.adaptive_spin = true}};
+	contended_lock(state, m);
+}
+BENCHMARK(BM_AsyncLock_Contended_AdaptiveMutex)->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
+
+// Like contended_lock() but woken waiters are posted to a run_queue. The first thread
+// drives the queue while the benchmark runs. The benchmark loop ends with a barrier,
+// i.e., the runner is only stopped once all threads acquired the mutex for the last time.
+void contended_deferred_lock(benchmark::State& state, async::run_queue &rq, async::mutex &m) {
+	std::optional<queue_runner> runner;
+	if (state.thread_index() == 0)
+		runner.emplace(rq);
+	contended_lock(state, m);
+}
+
+// Baseline for BM_AsyncLock_Contended_BargingMutex: same wakeup path but fair hand-off.
+static void BM_AsyncLock_Contended_DeferredMutex(benchmark::State& state) {
+	static async::run_queue rq;
+	static async::mutex m{{.wakeup_queue = &rq}};
+	contended_deferred_lock(state, rq, m);
+}
+BENCHMARK(BM_AsyncLock_Contended_DeferredMutex)->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
+
+static void BM_AsyncLock_Contended_BargingMutex(benchmark::State& state) {
+	static async::run_queue rq;
+	static async::mutex m{{.barging = true, .wakeup_queue = &rq}};
+	contended_deferred_lock(state, rq, m);
+}
+BENCHMARK(BM_AsyncLock_Contended_BargingMutex)->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+#include <async/basic.hpp>
+#include <async/cancellation.hpp>
+#include <async/wait-group.hpp>
+
+namespace async {
+
+// Tracks a dynamic set of detached operations and allows waiting until all of them complete.
+// Control blocks of spawned operations are carved out of fixed-size slots that are recycled
+// through a free list. Only operations whose control block does not fit into a slot
+// fall back to the allocator.
+template<typename Allocator = frg::stl_allocator, size_t SlotSize = 256, size_t SlotsPerChunk = 64>
+struct async_scope {
+	static_assert(SlotsPerChunk > 0);
+
+private:
+	union slot {
+		slot *next;
+		alignas(alignof(std::max_align_t)) char buffer[SlotSize];
+	};
+
+	struct chunk {
+		chunk *next = nullptr;
+		slot slots[SlotsPerChunk];
+	};
+
+	template<typename S>
+	struct control_block;
+
+	template<typename S>
+	struct final_receiver {
+		final_receiver(control_block<S> *cb)
+		: cb_{cb} { }
+
+		template<typename... Args>
+		void set_value(Args &&...) {
+			cb_->self->retire_(cb_);
+		}
+
+	private:
+		control_block<S> *cb_;
+	};
+
+	// We cannot directly put the operation into a slot as it is non-movable.
+	template<typename S>
+	struct control_block {
+		control_block(async_scope *self, S sender)
+		: self{self},
+				operation{execution::connect(std::move(sender), final_receiver<S>{this})} { }
+
+		async_scope *self;
+		execution::operation_t<S, final_receiver<S>> operation;
+	};
+
+	template<typename S>
+	static constexpr bool fits_slot = sizeof(control_block<S>) <= sizeof(slot)
+			&& alignof(control_block<S>) <= alignof(slot);
+
+public:
+	async_scope(Allocator allocator = {})
+	: allocator_{std::move(allocator)} { }
+
+	async_scope(const async_scope &) = delete;
+
+	async_scope &operator= (const async_scope &) = delete;
+
+	// All spawned operations must be complete (e.g., by awaiting join()) at this point.
+	~async_scope() {
+		while(chunks_) {
+			auto ch = chunks_;
+			chunks_ = ch->next;
+			frg::destruct(allocator_, ch);
+		}
+	}
+
+	template<Sender S>
+	void spawn(S sender) {
+		wg_.add(1);
+
+		control_block<S> *cb;
+		if constexpr (fits_slot<S>) {
+			cb = new (allocate_slot_()) control_block<S>{this, std::move(sender)};
+		}else{
+			cb = frg::construct<control_block<S>>(allocator_, this, std::move(sender));
+		}
+		execution::start_inline(cb->operation);
+	}
+
+	// Completes once all operations spawned so far are done.
+	auto join(cancellation_token ct) {
+		return wg_.wait(ct);
+	}
+
+	auto join() {
+		return wg_.wait();
+	}
+
+private:
+	void *allocate_slot_() {
+		frg::unique_lock lock{mutex_};
+
+		if(!free_slots_) {
+			auto ch = frg::construct<chunk>(allocator_);
+			ch->next = chunks_;
+			chunks_ = ch;
+			for(size_t i = SlotsPerChunk; i > 0; --i) {
+				auto sl = &ch->slots[i - 1];
+				sl->next = free_slots_;
+				free_slots_ = sl;
+			}
+		}
+
+		auto sl = free_slots_;
+		free_slots_ = sl->next;
+		return sl;
+	}
+
+	void free_slot_(void *p) {
+		frg::unique_lock lock{mutex_};
+
+		auto sl = static_cast<slot *>(p);
+		sl->next = free_slots_;
+		free_slots_ = sl;
+	}
+
+	template<typename S>
+	void retire_(control_block<S> *cb) {
+		if constexpr (fits_slot<S>) {
+			cb->~control_block();
+			free_slot_(cb);
+		}else{
+			frg::destruct(allocator_, cb);
+		}
+
+		// Note that join() may complete here, so we must not touch this afterwards.
+		wg_.done();
+	}
+
+	Allocator allocator_;
+
+	platform::mutex mutex_;
+
+	// Protected by mutex_.
+	chunk *chunks_ = nullptr;
+	slot *free_slots_ = nullptr;
+
+	wait_group wg_{0};
+};
+
+} // namespace async
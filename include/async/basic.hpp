@@ -16,6 +16,10 @@
 #include <iostream>
 #include <cassert>
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 namespace async::platform {
 	using mutex = std::mutex;
 
@@ -23,6 +27,20 @@ namespace async::platform {
 		std::cerr << str << std::endl;
 		std::terminate();
 	}
+
+	// Returns the index of the current CPU. This is only used as a hint,
+	// i.e., the thread can migrate at any time.
+	inline size_t current_cpu() {
+#ifdef __linux__
+		auto cpu = sched_getcpu();
+		if (cpu >= 0)
+			return cpu;
+#endif
+		// Fall back to a distinct index per thread.
+		static std::atomic<size_t> next{0};
+		thread_local size_t id = next.fetch_add(1, std::memory_order_relaxed);
+		return id;
+	}
 } // namespace async::platform
 #else
 #include <async/platform.hpp>
@@ -338,19 +356,50 @@ struct run_queue {
 		return {this};
 	}
 
-	void post(run_queue_item *node);
+	// Can be called from any thread.
+	void post(run_queue_item *node) {
+		assert(node->_cb && "run_queue_item is not armed");
+		frg::unique_lock lock{_mutex};
+		_run_list.push_back(node);
+	}
 
 private:
-	frg::intrusive_list<
+	using item_list = frg::intrusive_list<
 		run_queue_item,
 		frg::locate_member<
 			run_queue_item,
 			frg::default_list_hook<run_queue_item>,
 			&run_queue_item::_hook
 		>
-	> _run_list;
+	>;
+
+	platform::mutex _mutex;
+	item_list _run_list;
 };
 
+// Runs all items that were posted before the call.
+// Items posted by these items are only run in the next iteration.
+inline void run_queue_token::run_iteration() {
+	run_queue::item_list items;
+	{
+		frg::unique_lock lock{rq_->_mutex};
+		items.splice(items.end(), rq_->_run_list);
+	}
+
+	while(!items.empty()) {
+		auto item = items.pop_front();
+		// Disarm before invoking such that the callback can re-arm the item.
+		auto cb = item->_cb;
+		item->_cb = {};
+		cb();
+	}
+}
+
+inline bool run_queue_token::is_drained() {
+	frg::unique_lock lock{rq_->_mutex};
+	return rq_->_run_list.empty();
+}
+
 // ----------------------------------------------------------------------------
 // Top-level execution functions.
 // ----------------------------------------------------------------------------
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <async/basic.hpp>
+#include <async/cancellation.hpp>
+#include <frg/container_of.hpp>
+#include <frg/expected.hpp>
+#include <frg/list.hpp>
+#include <frg/optional.hpp>
+
+namespace async {
+
+enum class broadcast_error {
+	success,
+	// The subscriber fell behind by more than N messages. Its cursor is moved to the oldest
+	// message that is still available.
+	lagged,
+	cancelled
+};
+
+// Channel that delivers every message to every subscriber. The channel keeps the last N
+// messages in a ring; each subscriber reads at its own cursor. Publishing never waits
+// for subscribers; instead, it overwrites the oldest message, and subscribers that did
+// not read that message yet observe broadcast_error::lagged.
+template<typename T, size_t N>
+struct broadcast_channel {
+	static_assert(N > 0);
+
+	using result_type = frg::expected<broadcast_error, T>;
+
+	// Position of a subscriber in the stream of messages.
+	struct subscriber {
+		friend struct broadcast_channel;
+
+	private:
+		subscriber(uint64_t cursor)
+		: cursor_{cursor} { }
+
+		// Sequence number of the next message to read.
+		uint64_t cursor_;
+	};
+
+private:
+	struct node {
+		friend struct broadcast_channel;
+
+	protected:
+		virtual ~node() = default;
+
+	public:
+		virtual void complete() = 0;
+
+	protected:
+		subscriber *sub;
+		// Set once the node is removed from waiters_.
+		frg::optional<result_type> result;
+
+	private:
+		frg::default_list_hook<node> hook_;
+	};
+
+	using node_list = frg::intrusive_list<
+		node,
+		frg::locate_member<
+			node,
+			frg::default_list_hook<node>,
+			&node::hook_
+		>
+	>;
+
+	bool try_cancel(node *nd) {
+		frg::unique_lock lock{mutex_};
+
+		if(!nd->result) {
+			waiters_.erase(waiters_.iterator_to(nd));
+			nd->result.emplace(broadcast_error::cancelled);
+			return true;
+		}
+		return false;
+	}
+
+	// Must be called with mutex_ held.
+	frg::optional<result_type> try_receive_(subscriber &s) {
+		auto oldest = head_ > N ? head_ - N : 0;
+		if(s.cursor_ < oldest) {
+			s.cursor_ = oldest;
+			return result_type{broadcast_error::lagged};
+		}
+		if(s.cursor_ == head_)
+			return {};
+		return result_type{*slots_[s.cursor_++ % N]};
+	}
+
+public:
+	broadcast_channel() = default;
+
+	broadcast_channel(const broadcast_channel &) = delete;
+
+	broadcast_channel &operator= (const broadcast_channel &) = delete;
+
+	// Returns a subscriber that receives all messages that are published from now on.
+	subscriber subscribe() {
+		frg::unique_lock lock{mutex_};
+		return subscriber{head_};
+	}
+
+	void publish(T item) {
+		emplace(std::move(item));
+	}
+
+	template<typename... Ts>
+	void emplace(Ts&&... arg) {
+		node_list pending;
+		{
+			frg::unique_lock lock{mutex_};
+
+			slots_[head_ % N].emplace(std::forward<Ts>(arg)...);
+			++head_;
+
+			// All waiters are at the end of the stream, i.e., they receive the new message.
+			pending.splice(pending.end(), waiters_);
+			for(auto nd : pending)
+				nd->result = try_receive_(*nd->sub);
+		}
+
+		while(!pending.empty())
+			pending.pop_front()->complete();
+	}
+
+	// Returns the next message for s, or frg::null_opt if s has read all messages.
+	frg::optional<result_type> try_receive(subscriber &s) {
+		frg::unique_lock lock{mutex_};
+		return try_receive_(s);
+	}
+
+	// ----------------------------------------------------------------------------------
+	// async_receive() and its boilerplate.
+	// ----------------------------------------------------------------------------------
+
+	template<typename Receiver>
+	struct receive_operation final : private node {
+		receive_operation(broadcast_channel *chan, subscriber *s, cancellation_token ct, Receiver r)
+		: chan_{chan}, ct_{std::move(ct)}, r_{std::move(r)} {
+			sub = s;
+		}
+
+		void start() {
+			bool fast_path = false;
+			{
+				frg::unique_lock lock{chan_->mutex_};
+
+				result = chan_->try_receive_(*sub);
+				if(result) {
+					fast_path = true;
+				}else{
+					chan_->waiters_.push_back(this);
+				}
+			}
+
+			if(fast_path)
+				return execution::set_value(r_, std::move(*result));
+			cr_.listen(ct_);
+		}
+
+	private:
+		using node::sub;
+		using node::result;
+
+		struct try_cancel_fn {
+			bool operator()(auto *cr) {
+				auto self = frg::container_of(cr, &receive_operation::cr_);
+				return self->chan_->try_cancel(self);
+			}
+		};
+		struct resume_fn {
+			void operator()(auto *cr) {
+				auto self = frg::container_of(cr, &receive_operation::cr_);
+				execution::set_value(self->r_, std::move(*self->result));
+			}
+		};
+
+		void complete() override {
+			cr_.complete();
+		}
+
+		broadcast_channel *chan_;
+		cancellation_token ct_;
+		Receiver r_;
+		cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+	};
+
+	struct receive_sender {
+		using value_type = result_type;
+
+		template<typename Receiver>
+		friend receive_operation<Receiver> connect(receive_sender s, Receiver r) {
+			return {s.chan, s.sub, s.ct, std::move(r)};
+		}
+
+		friend sender_awaiter<receive_sender, result_type> operator co_await (receive_sender s) {
+			return {s};
+		}
+
+		broadcast_channel *chan;
+		subscriber *sub;
+		cancellation_token ct;
+	};
+
+	// Waits for the next message for s. At most one async_receive() operation may be
+	// pending per subscriber.
+	receive_sender async_receive(subscriber &s, cancellation_token ct = {}) {
+		return {this, &s, ct};
+	}
+
+private:
+	platform::mutex mutex_;
+
+	// Sequence number of the next message. The message with sequence number seq
+	// is stored in slots_[seq % N].
+	uint64_t head_ = 0;
+	frg::optional<T> slots_[N];
+
+	// Receive operations of subscribers that have read all messages.
+	node_list waiters_;
+};
+
+} // namespace async
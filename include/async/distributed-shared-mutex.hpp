@@ -0,0 +1,302 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include <async/basic.hpp>
+#include <frg/list.hpp>
+
+namespace async {
+
+// Variant of shared_mutex for read-mostly data. Each CPU has its own reader counter
+// on a separate cache line; unless a writer is present, acquiring and releasing a shared
+// lock only touches the counter of the current CPU. In turn, writers are expensive since
+// they need to scan all counters to determine whether readers are still present.
+template<size_t Slots = 64>
+struct distributed_shared_mutex {
+	static_assert(Slots > 0);
+
+private:
+	static constexpr size_t cache_line_size = 64;
+
+	struct node {
+		node() = default;
+
+		node(const node &) = delete;
+
+		node &operator= (const node &) = delete;
+
+		virtual void complete() = 0;
+
+		frg::default_list_hook<node> hook;
+
+	protected:
+		~node() = default;
+	};
+
+	using node_list = frg::intrusive_list<
+		node,
+		frg::locate_member<
+			node,
+			frg::default_list_hook<node>,
+			&node::hook
+		>
+	>;
+
+	// Readers may release their lock on a different CPU than the one that they acquired it on.
+	// Hence, individual counters can wrap around; only the sum over all slots is meaningful.
+	struct alignas(cache_line_size) slot {
+		std::atomic<size_t> count{0};
+	};
+
+public:
+	distributed_shared_mutex() = default;
+
+	distributed_shared_mutex(const distributed_shared_mutex &) = delete;
+
+	distributed_shared_mutex &operator= (const distributed_shared_mutex &) = delete;
+
+	// ------------------------------------------------------------------------------
+	// async_lock and boilerplate.
+	// ------------------------------------------------------------------------------
+
+	template<typename R>
+	struct [[nodiscard]] lock_operation final : private node {
+		lock_operation(distributed_shared_mutex *self, R receiver)
+		: self_{self}, receiver_{std::move(receiver)} { }
+
+		void start() {
+			if (self_->lock_or_enqueue_(this))
+				return execution::set_value(receiver_);
+		}
+
+	private:
+		void complete() override {
+			execution::set_value(receiver_);
+		}
+
+		distributed_shared_mutex *self_;
+		R receiver_;
+	};
+
+	struct [[nodiscard]] lock_sender {
+		using value_type = void;
+
+		template<typename R>
+		lock_operation<R> connect(R receiver) {
+			return {self, std::move(receiver)};
+		}
+
+		sender_awaiter<lock_sender>
+		operator co_await () {
+			return {*this};
+		}
+
+		distributed_shared_mutex *self;
+	};
+
+	lock_sender async_lock() {
+		return {this};
+	}
+
+	// ------------------------------------------------------------------------------
+	// async_lock_shared and boilerplate.
+	// ------------------------------------------------------------------------------
+
+	template<typename R>
+	struct [[nodiscard]] lock_shared_operation final : private node {
+		lock_shared_operation(distributed_shared_mutex *self, R receiver)
+		: self_{self}, receiver_{std::move(receiver)} { }
+
+		void start() {
+			if (self_->lock_shared_or_enqueue_(this))
+				return execution::set_value(receiver_);
+		}
+
+	private:
+		void complete() override {
+			execution::set_value(receiver_);
+		}
+
+		distributed_shared_mutex *self_;
+		R receiver_;
+	};
+
+	struct [[nodiscard]] lock_shared_sender {
+		using value_type = void;
+
+		template<typename R>
+		lock_shared_operation<R> connect(R receiver) {
+			return {self, std::move(receiver)};
+		}
+
+		sender_awaiter<lock_shared_sender>
+		operator co_await () {
+			return {*this};
+		}
+
+		distributed_shared_mutex *self;
+	};
+
+	lock_shared_sender async_lock_shared() {
+		return {this};
+	}
+
+	// ------------------------------------------------------------------------------
+
+	bool try_lock() {
+		frg::unique_lock lock(mutex_);
+
+		if (writer_.load(std::memory_order_relaxed))
+			return false;
+
+		writer_.store(true, std::memory_order_seq_cst);
+		if (drained_())
+			return true;
+		// Readers that observed writer_ in the meantime retry under mutex_.
+		writer_.store(false, std::memory_order_seq_cst);
+		return false;
+	}
+
+	bool try_lock_shared() {
+		auto &s = local_slot_();
+		s.count.fetch_add(1, std::memory_order_seq_cst);
+		if (!writer_.load(std::memory_order_seq_cst))
+			return true;
+
+		// Back off. Our increment might have prevented a writer from observing that
+		// all readers are gone, so we need to check for that.
+		s.count.fetch_sub(1, std::memory_order_seq_cst);
+		if (auto w = claim_drained_(); w)
+			w->complete();
+		return false;
+	}
+
+	void unlock() {
+		assert(writer_.load(std::memory_order_relaxed));
+
+		node_list pending;
+		{
+			frg::unique_lock lock(mutex_);
+
+			if (!readers_.empty()) {
+				// Admit all waiting readers at once.
+				size_t n = 0;
+				while (!readers_.empty()) {
+					pending.push_back(readers_.pop_front());
+					++n;
+				}
+				local_slot_().count.fetch_add(n, std::memory_order_seq_cst);
+
+				if (writers_.empty()) {
+					writer_.store(false, std::memory_order_seq_cst);
+				} else {
+					// writer_ stays set. The next writer acquires the lock once these readers are gone.
+					drain_waiter_.store(writers_.pop_front(), std::memory_order_seq_cst);
+				}
+			} else if (!writers_.empty()) {
+				// Hand-off to the next writer; writer_ stays set.
+				pending.push_back(writers_.pop_front());
+			} else {
+				writer_.store(false, std::memory_order_seq_cst);
+			}
+		}
+
+		while (!pending.empty())
+			pending.pop_front()->complete();
+	}
+
+	void unlock_shared() {
+		local_slot_().count.fetch_sub(1, std::memory_order_seq_cst);
+
+		// If there is no writer, we are done. Otherwise, we might be the last reader.
+		if (!writer_.load(std::memory_order_seq_cst))
+			return;
+		if (auto w = claim_drained_(); w)
+			w->complete();
+	}
+
+private:
+	slot &local_slot_() {
+		return slots_[platform::current_cpu() % Slots];
+	}
+
+	bool drained_() {
+		size_t sum = 0;
+		for (auto &s : slots_)
+			sum += s.count.load(std::memory_order_seq_cst);
+		return !sum;
+	}
+
+	// Returns the writer that waits for readers to drain if there are no readers anymore.
+	// The caller is responsible for completing that writer.
+	node *claim_drained_() {
+		while (true) {
+			// Claim the writer before scanning. Otherwise, we could observe a stale sum
+			// from before a new batch of readers was admitted.
+			auto w = drain_waiter_.exchange(nullptr, std::memory_order_seq_cst);
+			if (!w)
+				return nullptr;
+			if (drained_())
+				return w;
+
+			drain_waiter_.store(w, std::memory_order_seq_cst);
+			// Readers that released their lock while we held w did not observe w.
+			// Hence, we have to check again and retry if all readers are gone.
+			if (!drained_())
+				return nullptr;
+		}
+	}
+
+	// Either acquires the mutex (and returns true) or enqueues nd as a waiter.
+	bool lock_or_enqueue_(node *nd) {
+		{
+			frg::unique_lock lock(mutex_);
+
+			if (writer_.load(std::memory_order_relaxed)) {
+				writers_.push_back(nd);
+				return false;
+			}
+
+			// From now on, new readers back off. Wait for existing readers to drain.
+			writer_.store(true, std::memory_order_seq_cst);
+			drain_waiter_.store(nd, std::memory_order_seq_cst);
+		}
+
+		auto w = claim_drained_();
+		assert(!w || w == nd);
+		return w != nullptr;
+	}
+
+	bool lock_shared_or_enqueue_(node *nd) {
+		if (try_lock_shared())
+			return true;
+
+		frg::unique_lock lock(mutex_);
+
+		// writer_ can only be set while holding mutex_.
+		if (!writer_.load(std::memory_order_relaxed)) {
+			local_slot_().count.fetch_add(1, std::memory_order_seq_cst);
+			return true;
+		}
+		readers_.push_back(nd);
+		return false;
+	}
+
+	slot slots_[Slots];
+
+	// Set while a writer holds the lock or waits for readers to drain.
+	// Transitions only happen while holding mutex_.
+	std::atomic<bool> writer_{false};
+
+	// Writer that waits for readers to drain.
+	std::atomic<node *> drain_waiter_{nullptr};
+
+	platform::mutex mutex_;
+
+	// The following fields are protected by mutex_.
+	node_list readers_;
+	node_list writers_;
+};
+
+} // namespace async
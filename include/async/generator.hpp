@@ -1,7 +1,9 @@
 #pragma once
 
 #include <async/basic.hpp>
+#include <frg/manual_box.hpp>
 #include <optional>
+#include <span>
 #include <utility>
 
 namespace async {
@@ -19,6 +21,12 @@ struct generator {
 		std::optional<T> current_value;
 		continuation *cont = nullptr;
 
+		// If batch is non-null, yielded values are stored into batch[0, batch_size)
+		// and the generator only suspends once the batch is full.
+		T *batch = nullptr;
+		size_t batch_size = 0;
+		size_t batch_count = 0;
+
 		generator get_return_object() {
 			return generator{corons::coroutine_handle<promise_type>::from_promise(*this)};
 		}
@@ -26,8 +34,12 @@ struct generator {
 		corons::suspend_always initial_suspend() noexcept { return {}; }
 
 		struct yield_awaiter {
-			bool await_ready() noexcept { return false; }
+			bool await_ready() noexcept { return ready; }
 
+			// Note that the body can co_await senders between yields (e.g., to perform IO):
+			// cont stays set while the body is suspended on a sender, and the consumer is
+			// resumed by the next yield, from the context that completed the sender.
+			// Hence, cont can only be null if the generator was resumed without next().
 			void await_suspend(handle_type h) noexcept {
 				auto cont = h.promise().cont;
 				h.promise().cont = nullptr;
@@ -39,9 +51,16 @@ struct generator {
 			}
 
 			void await_resume() noexcept {}
+
+			bool ready = false;
 		};
 
 		yield_awaiter yield_value(T value) noexcept {
+			if (batch) {
+				batch[batch_count++] = std::move(value);
+				// Continue producing without a round trip to the consumer until the batch is full.
+				return yield_awaiter{batch_count < batch_size};
+			}
 			current_value = std::move(value);
 			return yield_awaiter{};
 		}
@@ -80,6 +99,10 @@ struct generator {
 		: h_{h}, r_{std::move(r)} {}
 
 		void start() {
+			// A batch may have already consumed the end of the generator.
+			if (h_.done())
+				return execution::set_value(std::move(r_), std::optional<T>{});
+
 			h_.promise().cont = this;
 			h_.resume();
 		}
@@ -112,8 +135,263 @@ struct generator {
 		return {h_};
 	}
 
+	template <typename Receiver>
+	struct next_batch_operation : continuation {
+		next_batch_operation(handle_type h, std::span<T> buffer, Receiver r)
+		: h_{h}, buffer_{buffer}, r_{std::move(r)} {}
+
+		void start() {
+			if (buffer_.empty() || h_.done())
+				return execution::set_value(std::move(r_), size_t{0});
+
+			auto &promise = h_.promise();
+			promise.cont = this;
+			promise.batch = buffer_.data();
+			promise.batch_size = buffer_.size();
+			promise.batch_count = 0;
+			h_.resume();
+		}
+
+		void complete() override {
+			auto &promise = h_.promise();
+			auto n = promise.batch_count;
+			promise.batch = nullptr;
+			promise.batch_size = 0;
+			promise.batch_count = 0;
+			execution::set_value(std::move(r_), n);
+		}
+
+		handle_type h_;
+		std::span<T> buffer_;
+		Receiver r_;
+	};
+
+	struct next_batch_sender {
+		handle_type h_;
+		std::span<T> buffer_;
+		using value_type = size_t;
+
+		friend sender_awaiter<next_batch_sender, size_t> operator co_await (next_batch_sender s) {
+			return {s};
+		}
+
+		template <typename Receiver>
+		next_batch_operation<Receiver> connect(Receiver r) {
+			return {h_, buffer_, std::move(r)};
+		}
+	};
+
+	// Produces up to buffer.size() items into buffer. Completes with the number of items
+	// that were produced; this is only less than buffer.size() if the generator is exhausted.
+	next_batch_sender next_batch(std::span<T> buffer) {
+		return {h_, buffer};
+	}
+
 private:
 	corons::coroutine_handle<promise_type> h_;
 };
 
+// Wraps a generator and keeps up to K items buffered in a fixed ring. The generator is
+// driven ahead of the consumer such that producing items (e.g., parsing or IO inside the
+// generator body) overlaps with processing them.
+//
+// The generator keeps running after next() completes until the ring is full. While it
+// is pumped, the pending operation refers to this object; callers must not destruct
+// the prefetching_generator before the ring is full or the generator is exhausted.
+template <typename T, size_t K>
+requires (K > 0)
+struct prefetching_generator {
+private:
+	struct node {
+		virtual void complete() = 0;
+
+		std::optional<T> value;
+
+	protected:
+		~node() = default;
+	};
+
+	// Distinguishes inline completion of the generator from asynchronous completion.
+	// Similar to coroutine_cfp, only the transitions matter.
+	enum class pump_cfp {
+		indeterminate,
+		past_start,
+		past_complete
+	};
+
+	struct pump_receiver {
+		void set_value(std::optional<T> item) {
+			auto s = self; // Pumping may destruct this.
+			s->item_ = std::move(item);
+			auto cfp = s->cfp_.exchange(pump_cfp::past_complete, std::memory_order_acq_rel);
+			if (cfp == pump_cfp::past_start) {
+				if (s->on_item_())
+					s->pump_();
+			}
+		}
+
+		prefetching_generator *self;
+	};
+
+	using pump_operation = execution::operation_t<typename generator<T>::next_sender, pump_receiver>;
+
+public:
+	explicit prefetching_generator(generator<T> gen)
+	: gen_{std::move(gen)} { }
+
+	// Pending pump operations refer to this object.
+	prefetching_generator(const prefetching_generator &) = delete;
+
+	prefetching_generator &operator= (const prefetching_generator &) = delete;
+
+	~prefetching_generator() {
+		frg::unique_lock lock{mutex_};
+		assert(!pumping_ && "prefetching_generator destructed while pumping");
+	}
+
+	template <typename Receiver>
+	struct next_operation final : private node {
+		next_operation(prefetching_generator *self, Receiver r)
+		: self_{self}, r_{std::move(r)} {}
+
+		void start() {
+			auto self = self_;
+			bool fast_path = false;
+			bool pump = false;
+			{
+				frg::unique_lock lock{self->mutex_};
+				assert(!self->waiter_ && "prefetching_generator supports only one consumer");
+
+				if (self->count_) {
+					value = self->pop_();
+					fast_path = true;
+				} else if (self->exhausted_) {
+					fast_path = true;
+				} else {
+					self->waiter_ = this;
+				}
+
+				// Since we consumed an item (or are waiting for one), there is space to read ahead.
+				if (!self->pumping_ && !self->exhausted_) {
+					self->pumping_ = true;
+					pump = true;
+				}
+			}
+
+			if (pump)
+				self->pump_();
+			if (fast_path)
+				return execution::set_value(std::move(r_), std::move(value));
+		}
+
+	private:
+		using node::value;
+
+		void complete() override {
+			execution::set_value(std::move(r_), std::move(value));
+		}
+
+		prefetching_generator *self_;
+		Receiver r_;
+	};
+
+	struct next_sender {
+		prefetching_generator *self;
+		using value_type = std::optional<T>;
+
+		friend sender_awaiter<next_sender, next_sender::value_type> operator co_await (next_sender s) {
+			return {s};
+		}
+
+		template <typename Receiver>
+		next_operation<Receiver> connect(Receiver r) {
+			return {self, std::move(r)};
+		}
+	};
+
+	next_sender next() {
+		return {this};
+	}
+
+private:
+	// Runs the generator until the ring is full, the generator is exhausted or
+	// the generator completes asynchronously. In the latter case, pump_receiver continues.
+	void pump_() {
+		while (true) {
+			box_.construct_with([&] {
+				return execution::connect(gen_.next(), pump_receiver{this});
+			});
+			cfp_.store(pump_cfp::indeterminate, std::memory_order_relaxed);
+			execution::start(*box_);
+			auto cfp = cfp_.exchange(pump_cfp::past_start, std::memory_order_acq_rel);
+			if (cfp != pump_cfp::past_complete)
+				return;
+			if (!on_item_())
+				return;
+		}
+	}
+
+	// Delivers item_ to the consumer or to the ring. Returns true if we should continue pumping.
+	bool on_item_() {
+		box_.destruct();
+
+		node *waiter = nullptr;
+		bool more;
+		{
+			frg::unique_lock lock{mutex_};
+
+			if (!item_)
+				exhausted_ = true;
+			if (waiter_) {
+				waiter = std::exchange(waiter_, nullptr);
+				waiter->value = std::move(item_);
+			} else if (item_) {
+				ring_[(head_ + count_) % K].emplace(std::move(*item_));
+				++count_;
+			}
+			item_.reset();
+
+			more = !exhausted_ && count_ < K;
+			if (!more)
+				pumping_ = false;
+		}
+
+		if (waiter)
+			waiter->complete();
+		return more;
+	}
+
+	// Must be called with mutex_ held.
+	T pop_() {
+		assert(count_);
+		auto v = std::move(*ring_[head_]);
+		ring_[head_].reset();
+		head_ = (head_ + 1) % K;
+		--count_;
+		return v;
+	}
+
+	generator<T> gen_;
+
+	// Only accessed by the (unique) pump.
+	frg::manual_box<pump_operation> box_;
+	std::optional<T> item_;
+	std::atomic<pump_cfp> cfp_{pump_cfp::indeterminate};
+
+	platform::mutex mutex_;
+
+	// The following fields are protected by mutex_.
+	std::optional<T> ring_[K];
+	size_t head_ = 0;
+	size_t count_ = 0;
+	node *waiter_ = nullptr;
+	bool pumping_ = false;
+	bool exhausted_ = false;
+};
+
+template <size_t K, typename T>
+prefetching_generator<T, K> prefetch(generator<T> gen) {
+	return prefetching_generator<T, K>{std::move(gen)};
+}
+
 } // namespace async
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+
+#include <async/basic.hpp>
+#include <frg/list.hpp>
+
+namespace async {
+
+// Provides mutual exclusion per key. Keys are hashed into a fixed number of stripes;
+// each stripe tracks the keys that are currently locked together with their waiters.
+// Hence, the memory usage is independent of the number of distinct keys.
+//
+// Ownership of a key is represented by a holder object that is provided by the caller.
+// It needs to stay alive (and must not be reused) while the key is locked or while
+// a lock operation on it is pending. No memory is allocated by this class.
+template<typename Key, typename Hash = std::hash<Key>, size_t Stripes = 64>
+struct keyed_mutex {
+	static_assert(Stripes > 0);
+
+	struct holder;
+
+private:
+	static constexpr size_t cache_line_size = 64;
+
+	struct node {
+		friend struct keyed_mutex;
+
+		node() = default;
+
+		node(const node &) = delete;
+
+		node &operator= (const node &) = delete;
+
+		virtual void complete() = 0;
+
+	protected:
+		~node() = default;
+
+	private:
+		// The following fields are protected by the mutex of the key's stripe.
+		holder *holder_ = nullptr;
+		frg::default_list_hook<node> hook_;
+	};
+
+	using node_list = frg::intrusive_list<
+		node,
+		frg::locate_member<
+			node,
+			frg::default_list_hook<node>,
+			&node::hook_
+		>
+	>;
+
+public:
+	struct holder {
+		friend struct keyed_mutex;
+
+		holder() = default;
+
+		holder(const holder &) = delete;
+
+		holder &operator= (const holder &) = delete;
+
+	private:
+		// The following fields are protected by the mutex of the key's stripe.
+		std::optional<Key> key_;
+		frg::default_list_hook<holder> hook_;
+		// Lock operations that wait for the key. They are passed on to the next holder.
+		node_list waiters_;
+		// Set if the holder owns the key.
+		bool locked_ = false;
+	};
+
+private:
+	using holder_list = frg::intrusive_list<
+		holder,
+		frg::locate_member<
+			holder,
+			frg::default_list_hook<holder>,
+			&holder::hook_
+		>
+	>;
+
+	struct alignas(cache_line_size) stripe {
+		platform::mutex mutex;
+		// Holders that currently own their key.
+		holder_list holders;
+	};
+
+public:
+	keyed_mutex() = default;
+
+	keyed_mutex(const keyed_mutex &) = delete;
+
+	keyed_mutex &operator= (const keyed_mutex &) = delete;
+
+	// ------------------------------------------------------------------------------
+	// async_lock and boilerplate.
+	// ------------------------------------------------------------------------------
+
+	template<typename R>
+	struct [[nodiscard]] lock_operation final : private node {
+		lock_operation(keyed_mutex *self, holder *h, Key key, R receiver)
+		: self_{self}, h_{h}, key_{std::move(key)}, receiver_{std::move(receiver)} { }
+
+		void start() {
+			if (self_->lock_or_enqueue_(h_, std::move(key_), this))
+				return execution::set_value(receiver_);
+		}
+
+	private:
+		void complete() override {
+			execution::set_value(receiver_);
+		}
+
+		keyed_mutex *self_;
+		holder *h_;
+		Key key_;
+		R receiver_;
+	};
+
+	struct [[nodiscard]] lock_sender {
+		using value_type = void;
+
+		template<typename R>
+		lock_operation<R> connect(R receiver) {
+			return {self, h, std::move(key), std::move(receiver)};
+		}
+
+		sender_awaiter<lock_sender>
+		operator co_await () {
+			return {std::move(*this)};
+		}
+
+		keyed_mutex *self;
+		holder *h;
+		Key key;
+	};
+
+	// Locks key on behalf of h. Waiters for the same key are served in FIFO order.
+	lock_sender async_lock(holder &h, Key key) {
+		return {this, &h, std::move(key)};
+	}
+
+	// ------------------------------------------------------------------------------
+
+	bool try_lock(holder &h, Key key) {
+		assert(!h.locked_);
+		auto &s = stripe_(key);
+		frg::unique_lock lock(s.mutex);
+
+		if (find_(s, key))
+			return false;
+		h.key_.emplace(std::move(key));
+		h.locked_ = true;
+		s.holders.push_back(&h);
+		return true;
+	}
+
+	void unlock(holder &h) {
+		assert(h.locked_);
+		auto &s = stripe_(*h.key_);
+
+		node *next = nullptr;
+		{
+			frg::unique_lock lock(s.mutex);
+
+			s.holders.erase(s.holders.iterator_to(&h));
+			h.locked_ = false;
+			h.key_.reset();
+
+			if (!h.waiters_.empty()) {
+				// Hand-off to the next waiter, which takes over the remaining waiters.
+				next = h.waiters_.pop_front();
+				auto nh = next->holder_;
+				nh->waiters_.splice(nh->waiters_.end(), h.waiters_);
+				nh->locked_ = true;
+				s.holders.push_back(nh);
+			}
+		}
+
+		if (next)
+			next->complete();
+	}
+
+private:
+	stripe &stripe_(const Key &key) {
+		return stripes_[Hash{}(key) % Stripes];
+	}
+
+	// Must be called with the stripe's mutex held.
+	holder *find_(stripe &s, const Key &key) {
+		for (auto h : s.holders) {
+			if (*h->key_ == key)
+				return h;
+		}
+		return nullptr;
+	}
+
+	// Either locks key for h (and returns true) or enqueues nd as a waiter.
+	bool lock_or_enqueue_(holder *h, Key key, node *nd) {
+		assert(!h->locked_);
+		auto &s = stripe_(key);
+		frg::unique_lock lock(s.mutex);
+
+		h->key_.emplace(std::move(key));
+		nd->holder_ = h;
+		if (auto owner = find_(s, *h->key_); owner) {
+			owner->waiters_.push_back(nd);
+			return false;
+		}
+		h->locked_ = true;
+		s.holders.push_back(h);
+		return true;
+	}
+
+	stripe stripes_[Stripes];
+};
+
+} // namespace async
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <async/basic.hpp>
+#include <async/cancellation.hpp>
+#include <frg/container_of.hpp>
+#include <frg/list.hpp>
+#include <frg/manual_box.hpp>
+#include <frg/optional.hpp>
+
+namespace async {
+
+// Bounded multi-producer multi-consumer queue on top of a ring of N cells.
+// Each cell carries a sequence number that tells producers and consumers whether the
+// cell is ready for them (D. Vyukov's bounded MPMC queue). Putting and getting items
+// is lock-free; only consumers that find the queue empty park under a mutex.
+template<typename T, size_t N>
+struct mpmc_queue {
+	static_assert(N >= 2 && !(N & (N - 1)), "N must be a power of two");
+
+private:
+	static constexpr size_t cache_line_size = 64;
+	static constexpr size_t mask = N - 1;
+
+	struct cell {
+		// If seq == pos, the cell is free for the producer at position pos.
+		// If seq == pos + 1, the cell holds the item for the consumer at position pos.
+		std::atomic<size_t> seq;
+		frg::manual_box<T> value;
+	};
+
+	struct sink {
+		friend struct mpmc_queue;
+
+	protected:
+		virtual ~sink() = default;
+
+	public:
+		virtual void complete() = 0;
+
+	protected:
+		frg::optional<T> value;
+
+	private:
+		frg::default_list_hook<sink> hook_;
+	};
+
+	using sink_list = frg::intrusive_list<
+		sink,
+		frg::locate_member<
+			sink,
+			frg::default_list_hook<sink>,
+			&sink::hook_
+		>
+	>;
+
+	bool try_cancel(sink *sp) {
+		frg::unique_lock lock{mutex_};
+
+		if(!sp->value) {
+			sinks_.erase(sinks_.iterator_to(sp));
+			parked_.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+		return false;
+	}
+
+public:
+	mpmc_queue() {
+		for(size_t i = 0; i < N; i++)
+			cells_[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	mpmc_queue(const mpmc_queue &) = delete;
+
+	mpmc_queue &operator= (const mpmc_queue &) = delete;
+
+	~mpmc_queue() {
+		assert(sinks_.empty());
+		while(maybe_get())
+			;
+	}
+
+	// Returns false if the queue is full.
+	bool try_put(T item) {
+		return try_emplace(std::move(item));
+	}
+
+	template<typename... Ts>
+	bool try_emplace(Ts&&... arg) {
+		auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+		cell *c;
+		while(true) {
+			c = &cells_[pos & mask];
+			auto seq = c->seq.load(std::memory_order_acquire);
+			auto diff = static_cast<intptr_t>(seq - pos);
+			if(!diff) {
+				if(enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}else if(diff < 0) {
+				// The consumer at position pos - N did not take its item yet.
+				return false;
+			}else{
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+
+		c->value.construct(std::forward<Ts>(arg)...);
+		c->seq.store(pos + 1, std::memory_order_release);
+
+		wake_();
+		return true;
+	}
+
+	frg::optional<T> maybe_get() {
+		auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+		cell *c;
+		while(true) {
+			c = &cells_[pos & mask];
+			auto seq = c->seq.load(std::memory_order_acquire);
+			auto diff = static_cast<intptr_t>(seq - (pos + 1));
+			if(!diff) {
+				if(dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}else if(diff < 0) {
+				// The producer at position pos did not publish its item yet.
+				return {};
+			}else{
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+
+		frg::optional<T> object{std::move(*c->value)};
+		c->value.destruct();
+		c->seq.store(pos + N, std::memory_order_release);
+		return object;
+	}
+
+	// ----------------------------------------------------------------------------------
+	// async_get() and its boilerplate.
+	// ----------------------------------------------------------------------------------
+
+	template<typename Receiver>
+	struct get_operation final : private sink {
+		get_operation(mpmc_queue *q, cancellation_token ct, Receiver r)
+		: q_{q}, ct_{std::move(ct)}, r_{std::move(r)} { }
+
+		void start() {
+			value = q_->maybe_get();
+			if(value)
+				return execution::set_value(r_, std::move(value));
+
+			bool fast_path = false;
+			{
+				frg::unique_lock lock{q_->mutex_};
+
+				// Announce that we are about to park, then check again. Either we observe
+				// items that were put concurrently, or their producers observe parked_.
+				q_->parked_.fetch_add(1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+
+				value = q_->maybe_get();
+				if(value) {
+					q_->parked_.fetch_sub(1, std::memory_order_relaxed);
+					fast_path = true;
+				}else{
+					q_->sinks_.push_back(this);
+				}
+			}
+
+			if(fast_path)
+				return execution::set_value(r_, std::move(value));
+			cr_.listen(ct_);
+		}
+
+	private:
+		using sink::value;
+
+		struct try_cancel_fn {
+			bool operator()(auto *cr) {
+				auto self = frg::container_of(cr, &get_operation::cr_);
+				return self->q_->try_cancel(self);
+			}
+		};
+		struct resume_fn {
+			void operator()(auto *cr) {
+				auto self = frg::container_of(cr, &get_operation::cr_);
+				execution::set_value(self->r_, std::move(self->value));
+			}
+		};
+
+		void complete() override {
+			cr_.complete();
+		}
+
+		mpmc_queue *q_;
+		cancellation_token ct_;
+		Receiver r_;
+		cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+	};
+
+	struct get_sender {
+		using value_type = frg::optional<T>;
+
+		template<typename Receiver>
+		friend get_operation<Receiver> connect(get_sender s, Receiver r) {
+			return {s.q, s.ct, std::move(r)};
+		}
+
+		friend sender_awaiter<get_sender, frg::optional<T>> operator co_await (get_sender s) {
+			return {s};
+		}
+
+		mpmc_queue *q;
+		cancellation_token ct;
+	};
+
+	get_sender async_get(cancellation_token ct = {}) {
+		return {this, ct};
+	}
+
+private:
+	// Hands items to parked consumers (if any).
+	void wake_() {
+		// Pairs with the fence in get_operation::start().
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(!parked_.load(std::memory_order_relaxed))
+			return;
+
+		sink_list pending;
+		{
+			frg::unique_lock lock{mutex_};
+
+			// Other consumers may have taken the item already; in this case, we are done.
+			while(!sinks_.empty()) {
+				auto object = maybe_get();
+				if(!object)
+					break;
+				auto sp = sinks_.pop_front();
+				sp->value = std::move(object);
+				parked_.fetch_sub(1, std::memory_order_relaxed);
+				pending.push_back(sp);
+			}
+		}
+
+		while(!pending.empty())
+			pending.pop_front()->complete();
+	}
+
+	alignas(cache_line_size) std::atomic<size_t> enqueue_pos_{0};
+	alignas(cache_line_size) std::atomic<size_t> dequeue_pos_{0};
+
+	alignas(cache_line_size) cell cells_[N];
+
+	// Number of consumers in sinks_ (or about to be). Only modified while holding mutex_.
+	alignas(cache_line_size) std::atomic<size_t> parked_{0};
+
+	platform::mutex mutex_;
+
+	sink_list sinks_;
+};
+
+} // namespace async
@@ -1,14 +1,67 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include <frg/container_of.hpp>
 #include <frg/list.hpp>
+#include <frg/manual_box.hpp>
 #include <async/basic.hpp>
+#include <async/cancellation.hpp>
 
 namespace async {
 
 namespace detail {
+	// Hint to the CPU that we are in a spin loop.
+	inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		asm volatile ("yield");
+#else
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+	}
+
+	struct mutex_options {
+		// Spin for a bounded number of iterations before enqueuing as a waiter.
+		// The spin budget adapts to how long the lock was recently held.
+		bool adaptive_spin = false;
+
+		// Instead of handing the lock directly to the next waiter, unlock() releases it
+		// and lets the woken waiter compete with other threads (barging).
+		// This improves throughput at the cost of fairness. Requires wakeup_queue (panics otherwise):
+		// a waiter that retried inline on the stack of unlock() would grab the mutex
+		// before any other thread could barge in.
+		bool barging = false;
+
+		// If set, unlock() posts woken waiters to this queue instead of completing them
+		// on the stack of unlock(). This bounds the latency of unlock() and avoids deep
+		// recursion if waiters unlock the mutex again within their completion.
+		run_queue *wakeup_queue = nullptr;
+	};
+
+	struct shared_mutex_options {
+		// See mutex_options::wakeup_queue.
+		run_queue *wakeup_queue = nullptr;
+
+		// Alternate between phases in which all waiting readers hold the lock and phases in
+		// which a single writer holds the lock. Readers that arrive while a writer is waiting
+		// join the next read phase, even if more writers are waiting.
+		// By default, waiters are served in strict FIFO order.
+		bool phase_fair = false;
+	};
+
+	struct condition_variable;
+
 	struct mutex {
+		friend struct condition_variable;
+
 	private:
 		struct node {
+			friend struct mutex;
+
 			node() = default;
 
 			node(const node &) = delete;
@@ -17,15 +70,46 @@ namespace detail {
 
 			virtual void complete() = 0;
 
-			frg::default_list_hook<node> hook;
-
 		protected:
 			~node() = default;
+
+		private:
+			// Links waiters, see st_ and head_.
+			node *next_ = nullptr;
+
+			// The following fields are protected by queue_mutex_ or by the owner's
+			// lock-free window (see windows_).
+			node *prev_ = nullptr;
+			bool queued_ = false;
+
+			// Only used by cancellable waiters. Protected by queue_mutex_.
+			bool cancellable_ = false;
+			// Set if the waiter was cancelled while it was popped but not yet
+			// re-enqueued by retry_() (barging only).
+			bool cancel_requested_ = false;
+			// Set if the operation completes without acquiring the mutex.
+			bool cancelled_ = false;
+
+			// Set by retry_() if the waiter lost the race against a barging thread.
+			// take_waiters_() puts such waiters back at the front of head_.
+			bool retrying_ = false;
+
+			// Used to post deferred wakeups.
+			mutex *waker_ = nullptr;
+			run_queue_item rq_item_;
 		};
 
 	public:
 		mutex() = default;
 
+		explicit mutex(mutex_options options)
+		: adaptive_spin_{options.adaptive_spin}, barging_{options.barging},
+				wakeup_queue_{options.wakeup_queue} {
+			// Otherwise, wake_() would complete the waiter inline after the mutex was released.
+			if (barging_ && !wakeup_queue_)
+				platform::panic("libasync: mutex barging requires a wakeup_queue");
+		}
+
 		// ------------------------------------------------------------------------------
 		// async_lock and boilerplate.
 		// ------------------------------------------------------------------------------
@@ -36,46 +120,8 @@ namespace detail {
 			: self_{self}, receiver_{std::move(receiver)} { }
 
 			void start() {
-				// Avoid taking mutex_ if possible.
-				if (self_->try_lock())
+				if (self_->spin_lock_() || self_->lock_or_enqueue_(this))
 					return execution::set_value(receiver_);
-
-				{
-					frg::unique_lock lock(self_->mutex_);
-
-					auto st = self_->st_.load(std::memory_order_relaxed);
-					while (true) {
-						if (st == state::none) {
-							bool success = self_->st_.compare_exchange_weak(
-								st,
-								state::locked,
-								std::memory_order_acquire,
-								std::memory_order_relaxed
-							);
-							if (success)
-								break;
-						} else if (st == state::locked) {
-							// CAS since there can be concurrent transitions from state::locked.
-							bool success = self_->st_.compare_exchange_weak(
-								st,
-								state::contended,
-								std::memory_order_relaxed,
-								std::memory_order_relaxed
-							);
-							if (success) {
-								self_->waiters_.push_back(this);
-								return;
-							}
-						} else {
-							// mutex_ protects against concurrent transitions from state::contended.
-							assert(st == state::contended);
-							self_->waiters_.push_back(this);
-							return;
-						}
-					}
-				}
-
-				return execution::set_value(receiver_);
 			}
 
 		private:
@@ -107,76 +153,432 @@ namespace detail {
 			return {this};
 		}
 
+		// ------------------------------------------------------------------------------
+		// Cancellable async_lock and boilerplate.
+		// ------------------------------------------------------------------------------
+
+		template<typename R>
+		struct [[nodiscard]] cancellable_lock_operation final : private node {
+			cancellable_lock_operation(mutex *self, cancellation_token ct, R receiver)
+			: self_{self}, ct_{std::move(ct)}, receiver_{std::move(receiver)} {
+				node::cancellable_ = true;
+			}
+
+			void start() {
+				if (self_->spin_lock_() || self_->lock_or_enqueue_(this))
+					return execution::set_value(receiver_, true);
+				cr_.listen(ct_);
+			}
+
+		private:
+			struct try_cancel_fn {
+				bool operator()(auto *cr) {
+					auto self = frg::container_of(cr, &cancellable_lock_operation::cr_);
+					return self->self_->try_cancel_(self);
+				}
+			};
+			struct resume_fn {
+				void operator()(auto *cr) {
+					auto self = frg::container_of(cr, &cancellable_lock_operation::cr_);
+					execution::set_value(self->receiver_, !self->node::cancelled_);
+				}
+			};
+
+			void complete() override {
+				cr_.complete();
+			}
+
+			mutex *self_;
+			cancellation_token ct_;
+			R receiver_;
+			cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+		};
+
+		struct [[nodiscard]] cancellable_lock_sender {
+			using value_type = bool;
+
+			template<typename R>
+			cancellable_lock_operation<R> connect(R receiver) {
+				return {self, ct, std::move(receiver)};
+			}
+
+			sender_awaiter<cancellable_lock_sender, bool>
+			operator co_await () {
+				return {*this};
+			}
+
+			mutex *self;
+			cancellation_token ct;
+		};
+
+		// Completes with true once the mutex is acquired or with false if ct is cancelled first.
+		cancellable_lock_sender async_lock(cancellation_token ct) {
+			return {this, ct};
+		}
+
 		// ------------------------------------------------------------------------------
 
 		bool try_lock() {
-			auto st = state::none;
+			auto st = st_.load(std::memory_order_relaxed);
+			while (st == not_locked || st == not_locked_queued) {
+				bool success = st_.compare_exchange_weak(
+					st,
+					(st == not_locked) ? locked_no_waiters : locked_queued,
+					std::memory_order_acquire,
+					std::memory_order_relaxed
+				);
+				if (success)
+					return true;
+			}
+			return false;
+		}
+
+		void unlock() {
+			assert(st_.load(std::memory_order_relaxed) != not_locked);
+			assert(st_.load(std::memory_order_relaxed) != not_locked_queued);
+
+			// If there are no waiters, we can simply unlock.
+			if (try_release_())
+				return;
+
+			// Only take queue_mutex_ if a cancellation is in progress.
+			node *next;
+			if (enter_window_()) {
+				next = pop_or_release_();
+				windows_.fetch_sub(1, std::memory_order_release);
+			} else {
+				frg::unique_lock lock(queue_mutex_);
+				next = pop_or_release_();
+			}
+
+			// Hand-off to a waiter does not require a fence.
+			if (next)
+				wake_(next);
+		}
+
+	private:
+		static constexpr unsigned int min_spins = 16;
+		static constexpr unsigned int max_spins = 1024;
+
+		// If adaptive spinning is enabled, spins until the mutex is released by its owner
+		// or until the spin budget is exhausted. Returns true if the mutex was acquired.
+		bool spin_lock_() {
+			if (!adaptive_spin_)
+				return false;
+			if (try_lock())
+				return true;
+
+			// spin_estimate_ tracks the number of iterations that it took to observe an unlock.
+			// Spinning is only worth it if the lock is typically held for a short time.
+			auto estimate = spin_estimate_.load(std::memory_order_relaxed);
+			auto budget = std::min(2 * estimate + min_spins, max_spins);
+			for (unsigned int i = 0; i < budget; ++i) {
+				cpu_relax();
+
+				// Unless barging is allowed, do not try to overtake waiters;
+				// they will be handed the lock directly.
+				auto st = st_.load(std::memory_order_relaxed);
+				if (!barging_ && st != not_locked && st != locked_no_waiters)
+					break;
+				if ((st == not_locked || st == not_locked_queued) && try_lock()) {
+					// Racy updates of the estimate are fine.
+					spin_estimate_.store((7 * estimate + i) / 8, std::memory_order_relaxed);
+					return true;
+				}
+			}
+
+			// Holds longer than the budget (or waiters ahead of us) make spinning less attractive.
+			spin_estimate_.store(7 * estimate / 8, std::memory_order_relaxed);
+			return false;
+		}
+
+		// Completes nd if it was handed the mutex. If barging is enabled, nd retries
+		// to acquire the mutex instead. Deferred to wakeup_queue_ if that is set.
+		void wake_(node *nd) {
+			if (!wakeup_queue_)
+				return nd->complete();
+
+			nd->waker_ = this;
+			nd->rq_item_.arm([nd] {
+				nd->waker_->retry_(nd);
+			});
+			wakeup_queue_->post(&nd->rq_item_);
+		}
+
+		// Runs from wakeup_queue_. Until then, other threads can barge in.
+		void retry_(node *nd) {
+			if (!barging_)
+				return nd->complete();
+
+			// If we lose the race, nd keeps its place in the queue.
+			nd->retrying_ = true;
+			if (!nd->cancellable_) {
+				if (!lock_or_enqueue_(nd))
+					return;
+				nd->retrying_ = false;
+				nd->complete();
+				return;
+			}
+
+			// Synchronize with try_cancel_(): either the cancellation finds nd in st_
+			// (or head_) or we see the cancellation request.
+			{
+				frg::unique_lock lock(queue_mutex_);
+
+				if (nd->cancel_requested_) {
+					nd->cancelled_ = true;
+				} else if (!lock_or_enqueue_(nd)) {
+					return;
+				}
+				nd->retrying_ = false;
+			}
+			nd->complete();
+		}
+
+		// Owners pop waiters in a lock-free window unless a cancellation is in progress.
+		// Returns false if the caller must take queue_mutex_ instead.
+		bool enter_window_() {
+			windows_.fetch_add(1, std::memory_order_seq_cst);
+			if (!cancelling_.load(std::memory_order_seq_cst))
+				return true;
+			windows_.fetch_sub(1, std::memory_order_release);
+			return false;
+		}
+
+		// Pops the next waiter. Returns nullptr if all waiters were cancelled in the meantime;
+		// in this case, the mutex is released. Must be called by the owner, either in
+		// a lock-free window or with queue_mutex_ held.
+		node *pop_or_release_() {
+			node *next;
+			while (!(next = pop_())) {
+				if (try_release_())
+					return nullptr;
+			}
+
+			// Release the lock, even if there are more waiters. The next owner is responsible
+			// for waking up the remaining waiters in head_.
+			if (barging_)
+				release_queued_();
+			return next;
+		}
+
+		// Transitions from locked_no_waiters to not_locked. Fails if there are waiters.
+		bool try_release_() {
+			auto st = locked_no_waiters;
 			return st_.compare_exchange_strong(
 				st,
-				state::locked,
-				std::memory_order_acquire,
+				not_locked,
+				std::memory_order_release,
 				std::memory_order_relaxed
 			);
 		}
 
-		void unlock() {
+		// Releases the mutex while waiters may remain in head_. Only used for barging.
+		// Must be called from pop_or_release_().
+		void release_queued_() {
 			auto st = st_.load(std::memory_order_relaxed);
-			assert(st != state::none);
-
-			// If there is no contention, we can unlock without taking mutex_.
-			if (st == state::locked) {
-				bool success = st_.compare_exchange_strong(
+			while (true) {
+				if (is_waiter_(st)) {
+					take_waiters_();
+					st = st_.load(std::memory_order_relaxed);
+					continue;
+				}
+				bool success = st_.compare_exchange_weak(
 					st,
-					state::none,
+					head_ ? not_locked_queued : not_locked,
 					std::memory_order_release,
 					std::memory_order_relaxed
 				);
 				if (success)
 					return;
 			}
-			// Only the owner ever transitions out of state::locked so we must be in state::contended.
-			assert(st == state::contended);
-
-			node *next;
-			{
-				frg::unique_lock lock(mutex_);
+		}
 
-				// Otherwise, we would not be in state::contended.
-				assert(!waiters_.empty());
+		// Moves all waiters from st_ to the end of head_ (or to the front of head_ if they
+		// are retrying). Must be called with exclusive access to head_ while st_ contains
+		// waiters. Since the mutex stays locked, this is not restricted to the owner.
+		void take_waiters_() {
+			auto st = st_.exchange(locked_queued, std::memory_order_acquire);
+			assert(is_waiter_(st));
+			auto nd = reinterpret_cast<node *>(st);
+
+			// The stack in st_ is in LIFO order, hence we reverse it to obtain FIFO order.
+			// New waiters and retrying waiters are collected in separate lists.
+			node *first[2] = {nullptr, nullptr};
+			node *last[2] = {nullptr, nullptr};
+			while (nd) {
+				auto next = nd->next_;
+				auto k = nd->retrying_ ? 1 : 0;
+				nd->next_ = first[k];
+				nd->prev_ = nullptr;
+				if (first[k]) {
+					first[k]->prev_ = nd;
+				} else {
+					last[k] = nd;
+				}
+				nd->queued_ = true;
+				nd->retrying_ = false;
+				first[k] = nd;
+				nd = next;
+			}
 
-				next = waiters_.pop_front();
-				if (waiters_.empty()) {
-					// Hand-off to a waiter does not require a fence.
-					st_.store(state::locked, std::memory_order_relaxed);
+			if (first[0]) {
+				first[0]->prev_ = tail_;
+				if (tail_) {
+					tail_->next_ = first[0];
+				} else {
+					head_ = first[0];
+				}
+				tail_ = last[0];
+			}
+			if (first[1]) {
+				last[1]->next_ = head_;
+				if (head_) {
+					head_->prev_ = last[1];
+				} else {
+					tail_ = last[1];
 				}
+				head_ = first[1];
 			}
+		}
 
-			next->complete();
+		// Removes the oldest waiter. Returns nullptr if there are no waiters.
+		// Must be called from pop_or_release_().
+		node *pop_() {
+			// With barging, st_ may contain retrying waiters that go before head_.
+			if ((!head_ || barging_) && is_waiter_(st_.load(std::memory_order_relaxed)))
+				take_waiters_();
+			if (!head_)
+				return nullptr;
+
+			auto nd = head_;
+			unlink_(nd);
+			return nd;
 		}
 
-	private:
-		enum class state {
-			none,
-			locked,
-			contended,
-		};
+		// Must be called with exclusive access to head_.
+		void unlink_(node *nd) {
+			assert(nd->queued_);
+			if (nd->prev_) {
+				nd->prev_->next_ = nd->next_;
+			} else {
+				head_ = nd->next_;
+			}
+			if (nd->next_) {
+				nd->next_->prev_ = nd->prev_;
+			} else {
+				tail_ = nd->prev_;
+			}
+			nd->next_ = nullptr;
+			nd->prev_ = nullptr;
+			nd->queued_ = false;
 
-		platform::mutex mutex_;
+			if (head_)
+				return;
+			// Allow fast-path releases again. If there are waiters in st_, we leave it alone.
+			auto st = st_.load(std::memory_order_relaxed);
+			while (st == locked_queued || st == not_locked_queued) {
+				bool success = st_.compare_exchange_weak(
+					st,
+					(st == locked_queued) ? locked_no_waiters : not_locked,
+					std::memory_order_relaxed,
+					std::memory_order_relaxed
+				);
+				if (success)
+					return;
+			}
+		}
 
-		// State transitions are protected by mutex_ except for the transitions:
-		// * state::none -> state::locked
-		// * state::locked -> state::none
-		// which can happen outside of mutex_.
-		std::atomic<state> st_{state::none};
+		// Removes nd from the waiters unless it was already handed the mutex.
+		bool try_cancel_(node *nd) {
+			frg::unique_lock lock(queue_mutex_);
+
+			// Wait until owners leave their lock-free windows. Since new owners
+			// take queue_mutex_ while cancelling_ is set, this wait is short.
+			cancelling_.store(true, std::memory_order_seq_cst);
+			while (windows_.load(std::memory_order_seq_cst))
+				cpu_relax();
+
+			// Waiters cannot be unlinked from the stack in st_, so move them to head_ first.
+			if (is_waiter_(st_.load(std::memory_order_relaxed)))
+				take_waiters_();
+
+			bool success = nd->queued_;
+			if (success) {
+				unlink_(nd);
+				nd->cancelled_ = true;
+			} else {
+				// nd was already popped by unlock(). With barging, retry_() may not have
+				// re-enqueued it yet; in this case, it completes nd as cancelled.
+				nd->cancel_requested_ = true;
+			}
 
-		frg::intrusive_list<
-			node,
-			frg::locate_member<
-				node,
-				frg::default_list_hook<node>,
-				&node::hook
-			>
-		> waiters_;
+			cancelling_.store(false, std::memory_order_release);
+			return success;
+		}
+
+		// Either acquires the mutex (and returns true) or enqueues nd as a waiter.
+		// In the latter case, nd->complete() is called once nd owns the mutex.
+		bool lock_or_enqueue_(node *nd) {
+			auto st = st_.load(std::memory_order_relaxed);
+			while (true) {
+				if (st == not_locked || st == not_locked_queued) {
+					bool success = st_.compare_exchange_weak(
+						st,
+						(st == not_locked) ? locked_no_waiters : locked_queued,
+						std::memory_order_acquire,
+						std::memory_order_relaxed
+					);
+					if (success)
+						return true;
+				} else {
+					// Push nd onto the stack of new waiters.
+					nd->next_ = is_waiter_(st) ? reinterpret_cast<node *>(st) : nullptr;
+					bool success = st_.compare_exchange_weak(
+						st,
+						reinterpret_cast<uintptr_t>(nd),
+						std::memory_order_release,
+						std::memory_order_relaxed
+					);
+					if (success)
+						return false;
+				}
+			}
+		}
+
+		static constexpr uintptr_t locked_no_waiters = 0;
+		static constexpr uintptr_t not_locked = 1;
+		// Locked; waiters are only in head_.
+		static constexpr uintptr_t locked_queued = 2;
+		// Not locked but there are waiters in head_. Only used for barging.
+		static constexpr uintptr_t not_locked_queued = 3;
+
+		static bool is_waiter_(uintptr_t st) {
+			return st > not_locked_queued;
+		}
+
+		// Either one of the constants above or a pointer to the most recently enqueued waiter.
+		// In the latter case, the mutex is locked and the waiters are linked through node::next_
+		// in LIFO order. Lock and unlock are done by lock-free atomic operations; if there are
+		// waiters in head_, st_ is never locked_no_waiters or not_locked.
+		std::atomic<uintptr_t> st_{not_locked};
+
+		// Protects head_ against cancellation. Contended unlocks only take it while
+		// a cancellation is in progress; otherwise, they access head_ in a lock-free window.
+		platform::mutex queue_mutex_;
+		// Number of owners in lock-free windows. While barging, windows can overlap.
+		std::atomic<unsigned int> windows_{0};
+		// Set while try_cancel_() needs exclusive access to head_.
+		std::atomic<bool> cancelling_{false};
+
+		// Waiters in FIFO order that were already taken from st_.
+		node *head_ = nullptr;
+		node *tail_ = nullptr;
+
+		bool adaptive_spin_ = false;
+		bool barging_ = false;
+		run_queue *wakeup_queue_ = nullptr;
+		std::atomic<unsigned int> spin_estimate_{0};
 	};
 
 	struct shared_mutex {
@@ -210,11 +612,33 @@ namespace detail {
 
 			frg::default_list_hook<node> hook;
 			bool exclusive;
+			bool upgradeable = false;
+
+			// The following fields are protected by mutex_.
+			// Set once the node leaves waiters_ since it was granted the lock.
+			bool granted = false;
+			// Set while the node is in upgrade_waiters_.
+			bool upgrade_queued = false;
+
+			// Used to post deferred wakeups.
+			run_queue_item rq_item;
 		};
 
+		using node_list = frg::intrusive_list<
+			node,
+			frg::locate_member<
+				node,
+				frg::default_list_hook<node>,
+				&node::hook
+			>
+		>;
+
 	public:
 		shared_mutex() = default;
 
+		explicit shared_mutex(shared_mutex_options options)
+		: wakeup_queue_{options.wakeup_queue}, phase_fair_{options.phase_fair} { }
+
 		// ------------------------------------------------------------------------------
 		// async_lock and boilerplate.
 		// ------------------------------------------------------------------------------
@@ -231,45 +655,8 @@ namespace detail {
 			}
 
 			void start() {
-				if (self_->try_lock())
+				if (self_->lock_or_enqueue_(this))
 					return execution::set_value(receiver_);
-
-				{
-					frg::unique_lock lock(self_->mutex_);
-
-					auto st = self_->st_.load(std::memory_order_relaxed);
-					while (true) {
-						if (st.c == contention::none) {
-							bool success = self_->st_.compare_exchange_weak(
-								st,
-								state{.c = contention::locked, .shared_cnt = 0},
-								std::memory_order_acquire,
-								std::memory_order_relaxed
-							);
-							if (success)
-								break;
-						} else if (st.c == contention::locked) {
-							// CAS since there can be concurrent transitions from contention::locked.
-							bool success = self_->st_.compare_exchange_weak(
-								st,
-								state{.c = contention::contended, .shared_cnt = st.shared_cnt},
-								std::memory_order_relaxed,
-								std::memory_order_relaxed
-							);
-							if (success) {
-								self_->waiters_.push_back(this);
-								return;
-							}
-						} else {
-							// mutex_ protects against concurrent transitions from contention::contended.
-							assert(st.c == contention::contended);
-							self_->waiters_.push_back(this);
-							return;
-						}
-					}
-				}
-
-				return execution::set_value(receiver_);
 			}
 
 		private:
@@ -317,58 +704,8 @@ namespace detail {
 			}
 
 			void start() {
-				if (self_->try_lock_shared())
+				if (self_->lock_shared_or_enqueue_(this))
 					return execution::set_value(receiver_);
-
-				{
-					frg::unique_lock lock(self_->mutex_);
-
-					auto st = self_->st_.load(std::memory_order_relaxed);
-					while (true) {
-						if (st.c == contention::none) {
-							bool success = self_->st_.compare_exchange_weak(
-								st,
-								state{.c = contention::locked, .shared_cnt = 1},
-								std::memory_order_acquire,
-								std::memory_order_relaxed
-							);
-							if (success)
-								break;
-						} else if (st.c == contention::locked && st.shared_cnt) {
-							// CAS since there can be concurrent transitions from contention::locked.
-							bool success = self_->st_.compare_exchange_weak(
-								st,
-								state{.c = contention::locked, .shared_cnt = st.shared_cnt + 1},
-								std::memory_order_acquire,
-								std::memory_order_relaxed
-							);
-							if (success)
-								break;
-						} else {
-							if (st.c == contention::locked) {
-								assert(!st.shared_cnt);
-								// CAS since there can be concurrent transitions from contention::locked.
-								bool success = self_->st_.compare_exchange_weak(
-									st,
-									state{.c = contention::contended, .shared_cnt = 0},
-									std::memory_order_relaxed,
-									std::memory_order_relaxed
-								);
-								if (success) {
-									self_->waiters_.push_back(this);
-									return;
-								}
-							} else {
-								// mutex_ protects against concurrent transitions from contention::contended.
-								assert(st.c == contention::contended);
-								self_->waiters_.push_back(this);
-								return;
-							}
-						}
-					}
-				}
-
-				return execution::set_value(receiver_);
 			}
 
 		private:
@@ -400,51 +737,258 @@ namespace detail {
 			return {this};
 		}
 
+		// ------------------------------------------------------------------------------
+		// async_lock_upgradeable and boilerplate.
 		// ------------------------------------------------------------------------------
 
-		bool try_lock() {
-			auto st = state{.c = contention::none, .shared_cnt = 0};
-			return st_.compare_exchange_strong(
-				st,
-				state{.c = contention::locked, .shared_cnt = 0},
-				std::memory_order_acquire,
-				std::memory_order_relaxed
-			);
-		}
+		template<typename R>
+		struct [[nodiscard]] lock_upgradeable_operation final : private node {
+		private:
+			using node::exclusive;
+			using node::upgradeable;
 
-		bool try_lock_shared() {
-			auto st = st_.load(std::memory_order_relaxed);
-			while (true) {
-				if (st.c == contention::none) {
-					bool success = st_.compare_exchange_strong(
-						st,
-						state{.c = contention::locked, .shared_cnt = 1},
-						std::memory_order_acquire,
-						std::memory_order_relaxed
-					);
-					if (success)
-						return true;
-				} else if(st.c == contention::locked && st.shared_cnt) {
-					bool success = st_.compare_exchange_strong(
-						st,
-						state{.c = contention::locked, .shared_cnt = st.shared_cnt + 1},
-						std::memory_order_acquire,
-						std::memory_order_relaxed
-					);
-					if (success)
-						return true;
-				} else {
-					return false;
-				}
+		public:
+			lock_upgradeable_operation(shared_mutex *self, R receiver)
+			: self_{self}, receiver_{std::move(receiver)} {
+				exclusive = false;
+				upgradeable = true;
 			}
-		}
 
-		void unlock() {
-			auto st = st_.load(std::memory_order_relaxed);
-			assert(st.c != contention::none);
-			assert(!st.shared_cnt);
+			void start() {
+				if (self_->lock_upgradeable_or_enqueue_(this))
+					return execution::set_value(receiver_);
+			}
 
-			// If there is no contention, we can unlock without taking mutex_.
+		private:
+			void complete() override {
+				execution::set_value(receiver_);
+			}
+
+			shared_mutex *self_;
+			R receiver_;
+		};
+
+		struct [[nodiscard]] lock_upgradeable_sender {
+			using value_type = void;
+
+			template<typename R>
+			lock_upgradeable_operation<R> connect(R receiver) {
+				return {self, std::move(receiver)};
+			}
+
+			sender_awaiter<lock_upgradeable_sender>
+			operator co_await () {
+				return {*this};
+			}
+
+			shared_mutex *self;
+		};
+
+		lock_upgradeable_sender async_lock_upgradeable() {
+			return {this};
+		}
+
+		// ------------------------------------------------------------------------------
+		// async_upgrade and boilerplate.
+		// ------------------------------------------------------------------------------
+
+		template<typename R>
+		struct [[nodiscard]] upgrade_operation final : private node {
+		private:
+			using node::exclusive;
+
+		public:
+			upgrade_operation(shared_mutex *self, R receiver)
+			: self_{self}, receiver_{std::move(receiver)} {
+				exclusive = true;
+			}
+
+			void start() {
+				if (self_->upgrade_or_enqueue_(this))
+					return execution::set_value(receiver_);
+			}
+
+		private:
+			void complete() override {
+				execution::set_value(receiver_);
+			}
+
+			shared_mutex *self_;
+			R receiver_;
+		};
+
+		struct [[nodiscard]] upgrade_sender {
+			using value_type = void;
+
+			template<typename R>
+			upgrade_operation<R> connect(R receiver) {
+				return {self, std::move(receiver)};
+			}
+
+			sender_awaiter<upgrade_sender>
+			operator co_await () {
+				return {*this};
+			}
+
+			shared_mutex *self;
+		};
+
+		upgrade_sender async_upgrade() {
+			return {this};
+		}
+
+		// ------------------------------------------------------------------------------
+		// Cancellable async_lock* and boilerplate.
+		// ------------------------------------------------------------------------------
+
+	private:
+		enum class lock_mode {
+			exclusive,
+			shared,
+			upgradeable
+		};
+
+	public:
+		template<typename R>
+		struct [[nodiscard]] cancellable_lock_operation final : private node {
+		private:
+			using node::exclusive;
+			using node::upgradeable;
+
+		public:
+			cancellable_lock_operation(shared_mutex *self, lock_mode mode,
+					cancellation_token ct, R receiver)
+			: self_{self}, mode_{mode}, ct_{std::move(ct)}, receiver_{std::move(receiver)} {
+				exclusive = (mode == lock_mode::exclusive);
+				upgradeable = (mode == lock_mode::upgradeable);
+			}
+
+			void start() {
+				bool fast_path = false;
+				switch (mode_) {
+				case lock_mode::exclusive:
+					fast_path = self_->lock_or_enqueue_(this);
+					break;
+				case lock_mode::shared:
+					fast_path = self_->lock_shared_or_enqueue_(this);
+					break;
+				case lock_mode::upgradeable:
+					fast_path = self_->lock_upgradeable_or_enqueue_(this);
+					break;
+				}
+
+				if (fast_path)
+					return execution::set_value(receiver_, true);
+				cr_.listen(ct_);
+			}
+
+		private:
+			struct try_cancel_fn {
+				bool operator()(auto *cr) {
+					auto self = frg::container_of(cr, &cancellable_lock_operation::cr_);
+					if (!self->self_->try_cancel_(self))
+						return false;
+					self->cancelled_ = true;
+					return true;
+				}
+			};
+			struct resume_fn {
+				void operator()(auto *cr) {
+					auto self = frg::container_of(cr, &cancellable_lock_operation::cr_);
+					execution::set_value(self->receiver_, !self->cancelled_);
+				}
+			};
+
+			void complete() override {
+				cr_.complete();
+			}
+
+			shared_mutex *self_;
+			lock_mode mode_;
+			cancellation_token ct_;
+			R receiver_;
+			cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+			bool cancelled_ = false;
+		};
+
+		struct [[nodiscard]] cancellable_lock_sender {
+			using value_type = bool;
+
+			template<typename R>
+			cancellable_lock_operation<R> connect(R receiver) {
+				return {self, mode, ct, std::move(receiver)};
+			}
+
+			sender_awaiter<cancellable_lock_sender, bool>
+			operator co_await () {
+				return {*this};
+			}
+
+			shared_mutex *self;
+			lock_mode mode;
+			cancellation_token ct;
+		};
+
+		// The following overloads complete with true once the lock is acquired
+		// or with false if ct is cancelled first.
+
+		cancellable_lock_sender async_lock(cancellation_token ct) {
+			return {this, lock_mode::exclusive, ct};
+		}
+
+		cancellable_lock_sender async_lock_shared(cancellation_token ct) {
+			return {this, lock_mode::shared, ct};
+		}
+
+		cancellable_lock_sender async_lock_upgradeable(cancellation_token ct) {
+			return {this, lock_mode::upgradeable, ct};
+		}
+
+		// ------------------------------------------------------------------------------
+
+		bool try_lock() {
+			auto st = state{.c = contention::none, .shared_cnt = 0};
+			return st_.compare_exchange_strong(
+				st,
+				state{.c = contention::locked, .shared_cnt = 0},
+				std::memory_order_acquire,
+				std::memory_order_relaxed
+			);
+		}
+
+		bool try_lock_shared() {
+			auto st = st_.load(std::memory_order_relaxed);
+			while (true) {
+				if (st.c == contention::none) {
+					bool success = st_.compare_exchange_strong(
+						st,
+						state{.c = contention::locked, .shared_cnt = 1},
+						std::memory_order_acquire,
+						std::memory_order_relaxed
+					);
+					if (success)
+						return true;
+				} else if(st.c == contention::locked && st.shared_cnt) {
+					bool success = st_.compare_exchange_strong(
+						st,
+						state{.c = contention::locked, .shared_cnt = st.shared_cnt + 1},
+						std::memory_order_acquire,
+						std::memory_order_relaxed
+					);
+					if (success)
+						return true;
+				} else {
+					return false;
+				}
+			}
+		}
+
+		void unlock() {
+			auto st = st_.load(std::memory_order_relaxed);
+			assert(st.c != contention::none);
+			assert(!st.shared_cnt);
+
+			// If there is no contention, we can unlock without taking mutex_.
 			if (st.c == contention::locked) {
 				bool success = st_.compare_exchange_strong(
 					st,
@@ -459,22 +1003,24 @@ namespace detail {
 			// Only the owner ever transitions out of state::locked so we must be in state::contended.
 			assert(st.c == contention::contended);
 
-			frg::intrusive_list<
-				node,
-				frg::locate_member<
-					node,
-					frg::default_list_hook<node>,
-					&node::hook
-				>
-			> pending;
+			node_list pending;
 			{
 				frg::unique_lock lock(mutex_);
 
-				// Otherwise, we would not be in state::contended.
-				assert(!waiters_.empty());
+				// All waiters might have been cancelled in the meantime.
+				if (waiters_.empty()) {
+					st_.store(
+						state{.c = contention::none, .shared_cnt = 0},
+						std::memory_order_release
+					);
+					return;
+				}
 
-				if(waiters_.front()->exclusive) {
-					pending.push_back(waiters_.pop_front());
+				auto n = take_readers_(pending);
+				if(!n) {
+					auto nd = waiters_.pop_front();
+					nd->granted = true;
+					pending.push_back(nd);
 					// Hand-off to a waiter does not require a fence.
 					if (waiters_.empty()) {
 						st_.store(
@@ -483,11 +1029,6 @@ namespace detail {
 						);
 					}
 				}else{
-					unsigned int n = 0;
-					while(!waiters_.empty() && !waiters_.front()->exclusive) {
-						pending.push_back(waiters_.pop_front());
-						++n;
-					}
 					// Hand-off to a waiter does not require a fence.
 					if (waiters_.empty()) {
 						st_.store(
@@ -505,90 +1046,419 @@ namespace detail {
 			assert(!pending.empty());
 
 			while(!pending.empty())
-				pending.pop_front()->complete();
+				wake_(pending.pop_front());
 		}
 
 		void unlock_shared() {
+			// If there is no contention or if we are not the last reader,
+			// we can unlock without taking mutex_.
+			if (try_unlock_shared_())
+				return;
+
+			node *next;
+			{
+				frg::unique_lock lock(mutex_);
+
+				// Cancelled waiters can cause transitions out of state::contended
+				// while we wait for mutex_. Hence, we need to check again.
+				if (try_unlock_shared_())
+					return;
+
+				// Note that the shared count cannot increase in state::contended outside of mutex_.
+				// Hence, we are the only owner of the mutex.
+
+				// Otherwise, we would not be in state::contended.
+				assert(!waiters_.empty());
+
+				// Otherwise, the node would not be waiting (but sharing the lock).
+				assert(waiters_.front()->exclusive);
+
+				next = waiters_.pop_front();
+				next->granted = true;
+				if (waiters_.empty()) {
+					// Hand-off to a waiter does not require a fence.
+					st_.store(
+						state{.c = contention::locked, .shared_cnt = 0},
+						std::memory_order_relaxed
+					);
+				} else {
+					// Hand-off to a waiter does not require a fence.
+					st_.store(
+						state{.c = contention::contended, .shared_cnt = 0},
+						std::memory_order_relaxed
+					);
+				}
+			}
+
+			wake_(next);
+		}
+
+		// Releases an upgradeable lock without upgrading it.
+		void unlock_upgradeable() {
+			node *next;
+			{
+				frg::unique_lock lock(mutex_);
+				next = release_upgradeable_();
+			}
+
+			unlock_shared();
+			if (next)
+				wake_(next);
+		}
+
+		// Converts an exclusive lock into a shared lock without releasing it in between.
+		// Readers that would be admitted by unlock() are admitted together with us.
+		void downgrade() {
 			auto st = st_.load(std::memory_order_relaxed);
 			assert(st.c != contention::none);
-			assert(st.shared_cnt);
+			assert(!st.shared_cnt);
 
-			// If there is no contention, we can unlock without taking mutex_.
-			// In contrast to unlock(), we need to loop here.
-			while (st.c == contention::locked) {
-				if (st.shared_cnt > 1) {
+			if (st.c == contention::locked) {
+				bool success = st_.compare_exchange_strong(
+					st,
+					state{.c = contention::locked, .shared_cnt = 1},
+					std::memory_order_release,
+					std::memory_order_relaxed
+				);
+				if (success)
+					return;
+				assert(!st.shared_cnt);
+			}
+			// Only the owner ever transitions out of state::locked so we must be in state::contended.
+			assert(st.c == contention::contended);
+
+			node_list pending;
+			{
+				frg::unique_lock lock(mutex_);
+
+				// Note that waiters_ can be empty if all waiters were cancelled.
+				auto n = take_readers_(pending);
+				if (waiters_.empty()) {
+					st_.store(
+						state{.c = contention::locked, .shared_cnt = n + 1},
+						std::memory_order_release
+					);
+				} else {
+					st_.store(
+						state{.c = contention::contended, .shared_cnt = n + 1},
+						std::memory_order_release
+					);
+				}
+			}
+
+			while(!pending.empty())
+				wake_(pending.pop_front());
+		}
+
+	private:
+		// Either acquires the lock (and returns true) or enqueues nd as a waiter.
+		bool lock_or_enqueue_(node *nd) {
+			if (try_lock())
+				return true;
+
+			frg::unique_lock lock(mutex_);
+
+			auto st = st_.load(std::memory_order_relaxed);
+			while (true) {
+				if (st.c == contention::none) {
 					bool success = st_.compare_exchange_weak(
 						st,
-						state{.c = contention::locked, .shared_cnt = st.shared_cnt - 1},
-						std::memory_order_release,
+						state{.c = contention::locked, .shared_cnt = 0},
+						std::memory_order_acquire,
 						std::memory_order_relaxed
 					);
 					if (success)
-						return;
+						return true;
+				} else if (st.c == contention::locked) {
+					// CAS since there can be concurrent transitions from contention::locked.
+					bool success = st_.compare_exchange_weak(
+						st,
+						state{.c = contention::contended, .shared_cnt = st.shared_cnt},
+						std::memory_order_relaxed,
+						std::memory_order_relaxed
+					);
+					if (success) {
+						waiters_.push_back(nd);
+						return false;
+					}
 				} else {
-					assert(st.shared_cnt == 1);
+					// mutex_ protects against concurrent transitions from contention::contended.
+					assert(st.c == contention::contended);
+					waiters_.push_back(nd);
+					return false;
+				}
+			}
+		}
+
+		bool lock_shared_or_enqueue_(node *nd) {
+			if (try_lock_shared())
+				return true;
+
+			frg::unique_lock lock(mutex_);
+			return lock_shared_locked_(nd);
+		}
+
+		// Same as lock_shared_or_enqueue_() but must be called with mutex_ held.
+		bool lock_shared_locked_(node *nd) {
+			auto st = st_.load(std::memory_order_relaxed);
+			while (true) {
+				if (st.c == contention::none) {
 					bool success = st_.compare_exchange_weak(
 						st,
-						state{.c = contention::none, .shared_cnt = 0},
-						std::memory_order_release,
+						state{.c = contention::locked, .shared_cnt = 1},
+						std::memory_order_acquire,
 						std::memory_order_relaxed
 					);
 					if (success)
-						return;
+						return true;
+				} else if (st.c == contention::locked && st.shared_cnt) {
+					// CAS since there can be concurrent transitions from contention::locked.
+					bool success = st_.compare_exchange_weak(
+						st,
+						state{.c = contention::locked, .shared_cnt = st.shared_cnt + 1},
+						std::memory_order_acquire,
+						std::memory_order_relaxed
+					);
+					if (success)
+						return true;
+				} else {
+					if (st.c == contention::locked) {
+						assert(!st.shared_cnt);
+						// CAS since there can be concurrent transitions from contention::locked.
+						bool success = st_.compare_exchange_weak(
+							st,
+							state{.c = contention::contended, .shared_cnt = 0},
+							std::memory_order_relaxed,
+							std::memory_order_relaxed
+						);
+						if (success) {
+							waiters_.push_back(nd);
+							return false;
+						}
+					} else {
+						// mutex_ protects against concurrent transitions from contention::contended.
+						assert(st.c == contention::contended);
+						waiters_.push_back(nd);
+						return false;
+					}
+				}
+			}
+		}
+
+		// At most one upgradeable lock exists at a time. Apart from that, it behaves like
+		// a shared lock; in particular, it does not block other readers.
+		bool lock_upgradeable_or_enqueue_(node *nd) {
+			frg::unique_lock lock(mutex_);
+
+			if (upgradeable_) {
+				nd->upgrade_queued = true;
+				upgrade_waiters_.push_back(nd);
+				return false;
+			}
+			upgradeable_ = true;
+			return lock_shared_locked_(nd);
+		}
+
+		bool upgrade_or_enqueue_(node *nd) {
+			bool success;
+			node *next;
+			{
+				frg::unique_lock lock(mutex_);
+
+				auto st = st_.load(std::memory_order_relaxed);
+				while (true) {
+					assert(st.c != contention::none);
+					assert(st.shared_cnt);
+
+					if (st.shared_cnt == 1) {
+						// We are the only owner. Keep the contention state, i.e., waiters remain queued.
+						success = st_.compare_exchange_weak(
+							st,
+							state{.c = st.c, .shared_cnt = 0},
+							std::memory_order_acquire,
+							std::memory_order_relaxed
+						);
+						if (success)
+							break;
+					} else {
+						// Drop our share and wait as an exclusive waiter in front of all other waiters.
+						// The last remaining reader then hands the lock over to us (see unlock_shared()).
+						// Moving to state::contended ensures that no new readers are admitted meanwhile.
+						bool enqueued = st_.compare_exchange_weak(
+							st,
+							state{.c = contention::contended, .shared_cnt = st.shared_cnt - 1},
+							std::memory_order_relaxed,
+							std::memory_order_relaxed
+						);
+						if (enqueued) {
+							waiters_.push_front(nd);
+							success = false;
+							break;
+						}
+					}
+				}
+
+				// The upgradeable lock is consumed by the upgrade.
+				next = release_upgradeable_();
+			}
+
+			if (next)
+				wake_(next);
+			return success;
+		}
+
+		// Passes the upgradeable lock on to the next waiter (if any).
+		// Returns that waiter if it can be completed immediately. Must be called with mutex_ held.
+		node *release_upgradeable_() {
+			assert(upgradeable_);
+
+			if (upgrade_waiters_.empty()) {
+				upgradeable_ = false;
+				return nullptr;
+			}
+
+			auto nd = upgrade_waiters_.pop_front();
+			nd->upgrade_queued = false;
+			if (lock_shared_locked_(nd)) {
+				nd->granted = true;
+				return nd;
+			}
+			return nullptr;
+		}
+
+		// Moves the readers that are admitted by the next read phase to pending.
+		// Returns the number of such readers. Must be called with mutex_ held.
+		unsigned int take_readers_(node_list &pending) {
+			unsigned int n = 0;
+			if (phase_fair_) {
+				// Start a read phase that includes all waiting readers, even those that are
+				// queued behind writers. Writers keep their relative order.
+				node_list writers;
+				while (!waiters_.empty()) {
+					auto nd = waiters_.pop_front();
+					if (nd->exclusive) {
+						writers.push_back(nd);
+					} else {
+						nd->granted = true;
+						pending.push_back(nd);
+						++n;
+					}
+				}
+				waiters_.splice(waiters_.end(), writers);
+			} else {
+				while(!waiters_.empty() && !waiters_.front()->exclusive) {
+					auto nd = waiters_.pop_front();
+					nd->granted = true;
+					pending.push_back(nd);
+					++n;
 				}
+			}
+			return n;
+		}
+
+		// Releases a shared lock unless that requires a transition out of state::contended.
+		bool try_unlock_shared_() {
+			auto st = st_.load(std::memory_order_relaxed);
+			while (true) {
 				assert(st.c != contention::none);
 				assert(st.shared_cnt);
-			}
-			// Only the owner ever transitions out of state::locked so we must be in state::contended.
-			assert(st.c == contention::contended);
 
-			// We can decrease shared lock count in state::contended state even outside of the mutex,
-			// as long as we do not need to transition out of state::contended.
-			while (st.shared_cnt > 1) {
+				state new_st;
+				if (st.c == contention::locked) {
+					if (st.shared_cnt > 1) {
+						new_st = state{.c = contention::locked, .shared_cnt = st.shared_cnt - 1};
+					} else {
+						new_st = state{.c = contention::none, .shared_cnt = 0};
+					}
+				} else if (st.shared_cnt > 1) {
+					// We can decrease shared lock count in state::contended state even outside of
+					// the mutex, as long as we do not need to transition out of state::contended.
+					new_st = state{.c = contention::contended, .shared_cnt = st.shared_cnt - 1};
+				} else {
+					return false;
+				}
+
 				bool success = st_.compare_exchange_weak(
 					st,
-					state{.c = contention::contended, .shared_cnt = st.shared_cnt - 1},
+					new_st,
 					std::memory_order_release,
 					std::memory_order_relaxed
 				);
 				if (success)
-					return;
+					return true;
 			}
-			assert(st.shared_cnt == 1);
+		}
 
-			node *next;
+		// Removes nd from the waiters unless it was already granted the lock.
+		bool try_cancel_(node *nd) {
+			node_list pending;
 			{
 				frg::unique_lock lock(mutex_);
 
-				// Note that the shared count cannot increase in state::contended.
-				// Hence, even after taking the mutex, we are the only owner of the mutex.
+				if (nd->granted)
+					return false;
 
-				// Otherwise, we would not be in state::contended.
-				assert(!waiters_.empty());
+				if (nd->upgrade_queued) {
+					upgrade_waiters_.erase(upgrade_waiters_.iterator_to(nd));
+					nd->upgrade_queued = false;
+					return true;
+				}
 
-				// Otherwise, the node would not be waiting (but sharing the lock).
-				assert(waiters_.front()->exclusive);
+				waiters_.erase(waiters_.iterator_to(nd));
 
-				next = waiters_.pop_front();
-				if (waiters_.empty()) {
-					// Hand-off to a waiter does not require a fence.
-					st_.store(
-						state{.c = contention::locked, .shared_cnt = 0},
-						std::memory_order_relaxed
-					);
-				} else {
-					// Hand-off to a waiter does not require a fence.
-					st_.store(
-						state{.c = contention::contended, .shared_cnt = 0},
-						std::memory_order_relaxed
-					);
+				// We are in state::contended since nd was waiting. If readers hold the lock,
+				// readers that were only blocked by nd can join them now.
+				auto st = st_.load(std::memory_order_relaxed);
+				assert(st.c == contention::contended);
+				if (st.shared_cnt) {
+					unsigned int n = 0;
+					while(!waiters_.empty() && !waiters_.front()->exclusive) {
+						auto rd = waiters_.pop_front();
+						rd->granted = true;
+						pending.push_back(rd);
+						++n;
+					}
+
+					// CAS since readers can release their locks concurrently.
+					while (true) {
+						bool success = st_.compare_exchange_weak(
+							st,
+							state{
+								.c = waiters_.empty() ? contention::locked : contention::contended,
+								.shared_cnt = st.shared_cnt + n
+							},
+							std::memory_order_relaxed,
+							std::memory_order_relaxed
+						);
+						if (success)
+							break;
+					}
+				}
+				// Otherwise, the exclusive owner deals with an empty waiters_ in unlock().
+
+				// A cancelled upgradeable waiter passes on the upgradeable lock.
+				if (nd->upgradeable) {
+					if (auto next = release_upgradeable_(); next)
+						pending.push_back(next);
 				}
 			}
 
-			next->complete();
+			while(!pending.empty())
+				wake_(pending.pop_front());
+			return true;
+		}
+
+		// Completes nd, either inline or by posting it to wakeup_queue_.
+		void wake_(node *nd) {
+			if (!wakeup_queue_)
+				return nd->complete();
+
+			nd->rq_item.arm([nd] {
+				nd->complete();
+			});
+			wakeup_queue_->post(&nd->rq_item);
 		}
 
-	private:
 		platform::mutex mutex_;
 
 		// State transitions are protected by mutex_ except for the transitions:
@@ -598,18 +1468,223 @@ namespace detail {
 		// which can happen outside of mutex_.
 		std::atomic<state> st_{state{.c = contention::none, .shared_cnt = 0}};
 
-		frg::intrusive_list<
+		node_list waiters_;
+
+		// Protected by mutex_. Set while an upgradeable lock is held or about to be granted.
+		bool upgradeable_ = false;
+		node_list upgrade_waiters_;
+
+		run_queue *wakeup_queue_ = nullptr;
+		bool phase_fair_ = false;
+	};
+
+	struct condition_variable {
+	private:
+		// Waiters are first linked into waiters_. On notification, they are moved directly
+		// to the waiters of the associated mutex, i.e., they do not need to be resumed
+		// just to contend on the mutex again.
+		struct node : mutex::node {
+			friend struct condition_variable;
+
+			node() = default;
+
+		protected:
+			~node() = default;
+
+			mutex *m_ = nullptr;
+
+		private:
+			// Protected by mutex_.
+			frg::default_list_hook<node> cv_hook_;
+			bool notified_ = false;
+		};
+
+		using node_list = frg::intrusive_list<
 			node,
 			frg::locate_member<
 				node,
 				frg::default_list_hook<node>,
-				&node::hook
+				&node::cv_hook_
 			>
-		> waiters_;
+		>;
+
+	public:
+		condition_variable() = default;
+
+		// ------------------------------------------------------------------------------
+		// async_wait and boilerplate.
+		// ------------------------------------------------------------------------------
+
+		template<typename Pred, typename R>
+		struct [[nodiscard]] wait_operation final : private node {
+			wait_operation(condition_variable *self, mutex *m, Pred pred,
+					cancellation_token ct, R receiver)
+			: self_{self}, pred_{std::move(pred)}, ct_{ct}, receiver_{std::move(receiver)} {
+				node::m_ = m;
+			}
+
+			wait_operation(const wait_operation &) = delete;
+
+			wait_operation &operator= (const wait_operation &) = delete;
+
+			void start() {
+				if (round_())
+					return execution::set_value(receiver_, result_);
+			}
+
+		private:
+			struct try_cancel_fn {
+				bool operator()(auto *) {
+					if (!self->self_->try_cancel_(self))
+						return false;
+					self->cancelled_ = true;
+					return true;
+				}
+
+				wait_operation *self;
+			};
+			struct resume_fn {
+				void operator()(auto *) {
+					auto s = self; // cr_.destruct() will destruct this.
+					s->cr_.destruct();
+
+					// On cancellation, we still need to re-acquire the mutex.
+					if (s->cancelled_ && !s->m_->lock_or_enqueue_(s))
+						return;
+					if (s->round_())
+						execution::set_value(s->receiver_, s->result_);
+				}
+
+				wait_operation *self;
+			};
+
+			using resolver = cancellation_resolver<try_cancel_fn, resume_fn>;
+
+			// Called with the mutex held. Returns true if the operation completes.
+			bool round_() {
+				result_ = pred_();
+				if (result_ || cancelled_)
+					return true;
+
+				cr_.construct_with([&] {
+					return resolver{try_cancel_fn{this}, resume_fn{this}};
+				});
+				{
+					frg::unique_lock lock(self_->mutex_);
+
+					node::notified_ = false;
+					self_->waiters_.push_back(this);
+				}
+				node::m_->unlock();
+				cr_->listen(ct_);
+				return false;
+			}
+
+			// Called once we own the mutex again.
+			void complete() override {
+				if (cancelled_) {
+					if (round_())
+						execution::set_value(receiver_, result_);
+					return;
+				}
+				cr_->complete();
+			}
+
+			condition_variable *self_;
+			Pred pred_;
+			cancellation_token ct_;
+			R receiver_;
+			frg::manual_box<resolver> cr_;
+			bool cancelled_ = false;
+			bool result_ = false;
+		};
+
+		template<typename Pred>
+		struct [[nodiscard]] wait_sender {
+			using value_type = bool;
+
+			template<typename R>
+			wait_operation<Pred, R> connect(R receiver) {
+				return {self, m, std::move(pred), ct, std::move(receiver)};
+			}
+
+			sender_awaiter<wait_sender, bool>
+			operator co_await () {
+				return {std::move(*this)};
+			}
+
+			condition_variable *self;
+			mutex *m;
+			Pred pred;
+			cancellation_token ct;
+		};
+
+		// The mutex must be held when calling this function. The mutex is released while
+		// waiting and it is held again when the operation completes.
+		template<typename Pred>
+		wait_sender<Pred> async_wait(mutex &m, Pred pred, cancellation_token ct = {}) {
+			return {this, &m, std::move(pred), ct};
+		}
+
+		// ------------------------------------------------------------------------------
+
+		void notify_one() {
+			node *nd;
+			{
+				frg::unique_lock lock(mutex_);
+
+				if (waiters_.empty())
+					return;
+				nd = waiters_.pop_front();
+				nd->notified_ = true;
+			}
+
+			if (nd->m_->lock_or_enqueue_(nd))
+				nd->complete();
+		}
+
+		void notify_all() {
+			node_list pending;
+			{
+				frg::unique_lock lock(mutex_);
+
+				pending.splice(pending.end(), waiters_);
+				for (auto nd : pending)
+					nd->notified_ = true;
+			}
+
+			// Only complete waiters after all of them are enqueued to avoid ping-ponging the lock.
+			node_list owners;
+			while (!pending.empty()) {
+				auto nd = pending.pop_front();
+				if (nd->m_->lock_or_enqueue_(nd))
+					owners.push_back(nd);
+			}
+
+			while (!owners.empty())
+				owners.pop_front()->complete();
+		}
+
+	private:
+		bool try_cancel_(node *nd) {
+			frg::unique_lock lock(mutex_);
+
+			if (nd->notified_)
+				return false;
+			waiters_.erase(waiters_.iterator_to(nd));
+			return true;
+		}
+
+		platform::mutex mutex_;
+
+		node_list waiters_;
 	};
 }
 
+using detail::mutex_options;
+using detail::shared_mutex_options;
 using detail::mutex;
 using detail::shared_mutex;
+using detail::condition_variable;
 
 } // namespace async
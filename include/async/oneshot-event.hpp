@@ -3,6 +3,7 @@
 #include <async/algorithm.hpp>
 #include <async/wait-group.hpp>
 #include <async/cancellation.hpp>
+#include <async/select.hpp>
 #include <frg/functional.hpp>
 #include <frg/list.hpp>
 
@@ -52,7 +53,8 @@ private:
 
 public:
 	void raise() {
-		auto old = state_.exchange(fired(), std::memory_order_acq_rel);
+		// seq_cst pairs with select_arm::link(), see has_arms_.
+		auto old = state_.exchange(fired(), std::memory_order_seq_cst);
 		// Calling raise() twice is an error.
 		assert(old != fired());
 		while (old) {
@@ -60,6 +62,25 @@ public:
 			old->complete_(old);
 			old = next;
 		}
+
+		if (!has_arms_.load(std::memory_order_seq_cst))
+			return;
+
+		// Fire all arms; arms of selectors that are not waiting are dropped.
+		arm_list claimed;
+		{
+			frg::unique_lock lock(arms_mutex_);
+
+			while (!arms_.empty()) {
+				auto arm = arms_.pop_front();
+				arm->linked_ = false;
+				if (arm->sel_->try_claim(arm->sel_index_))
+					claimed.push_back(arm);
+			}
+		}
+
+		while (!claimed.empty())
+			claimed.pop_front()->sel_->complete();
 	}
 
 	// ----------------------------------------------------------------------------------
@@ -117,12 +138,85 @@ public:
 		return wait_sender{this};
 	}
 
+	// ----------------------------------------------------------------------------------
+	// Support for selector.
+	// ----------------------------------------------------------------------------------
+
+	// Arm of a selector. Fires immediately if the event was already raised.
+	// Unlike waiters of async_wait(), arms are kept in a list that is protected by a lock,
+	// such that they can be unlinked when the selector is destroyed.
+	struct select_arm final {
+		friend struct oneshot_primitive;
+
+		select_arm(oneshot_primitive &evt)
+		: evt_{&evt} { }
+
+		select_arm(const select_arm &) = delete;
+
+		select_arm &operator= (const select_arm &) = delete;
+
+		void link(select_waiter *w, size_t index) {
+			{
+				frg::unique_lock lock(evt_->arms_mutex_);
+
+				sel_ = w;
+				sel_index_ = index;
+				// Either raise() observes has_arms_ or we observe fired().
+				evt_->has_arms_.store(true, std::memory_order_seq_cst);
+				if (evt_->state_.load(std::memory_order_seq_cst) != fired()) {
+					// Otherwise, the arm is still linked from a previous async_select().
+					if (!linked_) {
+						evt_->arms_.push_back(this);
+						linked_ = true;
+					}
+					return;
+				}
+			}
+
+			if (w->try_claim(index))
+				w->complete();
+		}
+
+		void unlink() {
+			frg::unique_lock lock(evt_->arms_mutex_);
+
+			if (linked_) {
+				evt_->arms_.erase(evt_->arms_.iterator_to(this));
+				linked_ = false;
+			}
+		}
+
+	private:
+		oneshot_primitive *evt_;
+
+		// The following fields are protected by arms_mutex_.
+		select_waiter *sel_ = nullptr;
+		size_t sel_index_ = 0;
+		bool linked_ = false;
+		frg::default_list_hook<select_arm> hook_;
+	};
+
 private:
 	// Possible states:
 	// nullptr       => no waiter
 	// valid pointer => waiter (i.e., head of list)
 	// fired()       => event fired already
 	std::atomic<node *> state_{nullptr};
+
+	using arm_list = frg::intrusive_list<
+		select_arm,
+		frg::locate_member<
+			select_arm,
+			frg::default_list_hook<select_arm>,
+			&select_arm::hook_
+		>
+	>;
+
+	// Arms of selectors that wait for the event. Since has_arms_ is never reset,
+	// raise() only takes arms_mutex_ if a selector was used with this event.
+	std::atomic<bool> has_arms_{false};
+	platform::mutex arms_mutex_;
+	arm_list arms_;
 };
 
 } // namespace async
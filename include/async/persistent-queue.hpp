@@ -0,0 +1,351 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <async/basic.hpp>
+#include <async/cancellation.hpp>
+#include <async/queue.hpp>
+#include <frg/container_of.hpp>
+#include <frg/list.hpp>
+#include <frg/optional.hpp>
+
+// Spilling items to disk requires a POSIX platform.
+#ifdef LIBASYNC_CUSTOM_PLATFORM
+#error "async/persistent-queue.hpp is not supported on custom platforms"
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace async {
+
+// Unbounded queue that keeps up to memory_capacity items in memory. Once that many items
+// are buffered, further items are appended to memory-mapped segment files in directory
+// (until the queue drained again). Hence, producers never wait, even if the queue grows
+// beyond the available RAM. Records are raw copies of T, i.e., they do not carry any
+// per-item overhead. Segment files are unlinked right after they are created. Once all
+// items of a segment are consumed, it is kept as a spare for the next segment (or unmapped
+// if there already is a spare). Segments are mapped and unmapped outside of the lock.
+template<typename T, typename Allocator>
+struct persistent_queue {
+	static_assert(std::is_trivially_copyable_v<T>, "Items are stored as raw bytes");
+
+	static constexpr size_t default_segment_size = size_t{64} << 20;
+
+	persistent_queue(std::string directory, size_t memory_capacity,
+			size_t segment_size = default_segment_size, Allocator allocator = {})
+	: directory_{std::move(directory)}, memory_capacity_{memory_capacity},
+			segment_size_{segment_size}, records_per_segment_{segment_size / sizeof(T)},
+			allocator_{allocator}, buffer_{allocator} {
+		assert(records_per_segment_ > 0);
+	}
+
+	persistent_queue(const persistent_queue &) = delete;
+
+	persistent_queue &operator= (const persistent_queue &) = delete;
+
+	~persistent_queue() {
+		while(!segments_.empty())
+			destroy_segment_(segments_.pop_front());
+		if(spare_)
+			destroy_segment_(spare_);
+	}
+
+private:
+	struct sink {
+		friend struct persistent_queue;
+
+	protected:
+		virtual ~sink() = default;
+
+	public:
+		virtual void complete() = 0;
+
+	protected:
+		frg::optional<T> value;
+
+	private:
+		frg::default_list_hook<sink> hook_;
+	};
+
+	struct segment {
+		segment(T *records)
+		: records{records} { }
+
+		// Points to the memory-mapped file.
+		T *records;
+		// Records in [read_index, write_index) are not consumed yet.
+		size_t read_index = 0;
+		size_t write_index = 0;
+		frg::default_list_hook<segment> hook;
+	};
+
+	bool try_cancel(sink *sp) {
+		frg::unique_lock lock{mutex_};
+
+		if(!sp->value) {
+			auto it = sinks_.iterator_to(sp);
+			sinks_.erase(it);
+			return true;
+		}
+		return false;
+	}
+
+	segment *create_segment_() {
+		auto path = directory_ + "/libasync-spill-XXXXXX";
+		int fd = mkstemp(path.data());
+		if(fd < 0)
+			platform::panic("libasync: Failed to create spill segment");
+		// The mapping keeps the file alive; this also reclaims the file if we crash.
+		unlink(path.c_str());
+
+		// Reserve the blocks up front. A sparse file would raise SIGBUS on the first write
+		// to a page that cannot be backed (e.g., since the disk is full).
+		if(posix_fallocate(fd, 0, segment_size_))
+			platform::panic("libasync: Failed to allocate spill segment");
+		auto base = mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(base == MAP_FAILED)
+			platform::panic("libasync: Failed to map spill segment");
+		close(fd);
+
+		return frg::construct<segment>(allocator_, static_cast<T *>(base));
+	}
+
+	void destroy_segment_(segment *sg) {
+		munmap(sg->records, segment_size_);
+		frg::destruct(allocator_, sg);
+	}
+
+	// Must be called with mutex_ held.
+	bool needs_segment_() {
+		return segments_.empty() || segments_.back()->write_index == records_per_segment_;
+	}
+
+	// Appends an item to the newest segment. Must be called with mutex_ held
+	// and !needs_segment_().
+	void append_(const T &object) {
+		auto sg = segments_.back();
+		new (&sg->records[sg->write_index]) T(object);
+		++sg->write_index;
+	}
+
+	// Removes the oldest item. Must be called with mutex_ held. If this exhausts a segment
+	// that cannot be kept as the spare, the segment is returned in retired; the caller
+	// must destroy it after releasing mutex_.
+	T pop_front_(segment *&retired) {
+		if(!buffer_.empty()) {
+			auto object = std::move(buffer_.front());
+			buffer_.pop_front();
+			--in_memory_;
+			return object;
+		}
+
+		auto sg = segments_.front();
+		T object{sg->records[sg->read_index]};
+		++sg->read_index;
+		// Unless this is the newest segment, write_index == records_per_segment_ here.
+		// In any case, the segment is not needed anymore.
+		if(sg->read_index == sg->write_index) {
+			segments_.pop_front();
+			if(!spare_) {
+				sg->read_index = 0;
+				sg->write_index = 0;
+				spare_ = sg;
+			}else{
+				retired = sg;
+			}
+		}
+		return object;
+	}
+
+	bool empty_() {
+		return buffer_.empty() && segments_.empty();
+	}
+
+public:
+	void put(T item) {
+		emplace(std::move(item));
+	}
+
+	template<typename... Ts>
+	void emplace(Ts&&... arg) {
+		sink *complete_sp = nullptr;
+		// Segment that we created outside of the lock since the newest segment was full.
+		segment *fresh = nullptr;
+		while(true) {
+			frg::unique_lock lock{mutex_};
+
+			if(!sinks_.empty()) {
+				assert(empty_());
+				auto sp = sinks_.pop_front();
+				sp->value.emplace(std::forward<Ts>(arg)...);
+				complete_sp = sp;
+			}else if(segments_.empty() && in_memory_ < memory_capacity_) {
+				// To preserve FIFO order, items only go to memory if nothing is spilled.
+				buffer_.emplace_back(std::forward<Ts>(arg)...);
+				++in_memory_;
+			}else{
+				if(needs_segment_()) {
+					if(!spare_ && !fresh) {
+						lock.unlock();
+						fresh = create_segment_();
+						continue;
+					}
+					segments_.push_back(spare_ ? std::exchange(spare_, nullptr)
+							: std::exchange(fresh, nullptr));
+				}
+				append_(T(std::forward<Ts>(arg)...));
+			}
+
+			// Keep a segment that we created in vain (due to a concurrent emplace()).
+			if(fresh && !spare_)
+				spare_ = std::exchange(fresh, nullptr);
+			break;
+		}
+
+		if(fresh)
+			destroy_segment_(fresh);
+		if(complete_sp)
+			complete_sp->complete();
+	}
+
+	// ----------------------------------------------------------------------------------
+	// async_get() and its boilerplate.
+	// ----------------------------------------------------------------------------------
+
+	template<typename Receiver>
+	struct get_operation final : private sink {
+		get_operation(persistent_queue *q, cancellation_token ct, Receiver r)
+		: q_{q}, ct_{std::move(ct)}, r_{std::move(r)} { }
+
+		void start() {
+			bool fast_path = false;
+			segment *retired = nullptr;
+			{
+				frg::unique_lock lock{q_->mutex_};
+
+				if(!q_->empty_()) {
+					assert(q_->sinks_.empty());
+					value = q_->pop_front_(retired);
+					fast_path = true;
+				}else{
+					q_->sinks_.push_back(this);
+				}
+			}
+
+			if(retired)
+				q_->destroy_segment_(retired);
+			if(fast_path)
+				return execution::set_value(r_, std::move(value));
+			cr_.listen(ct_);
+		}
+
+	private:
+		using sink::value;
+
+		struct try_cancel_fn {
+			bool operator()(auto *cr) {
+				auto self = frg::container_of(cr, &get_operation::cr_);
+				return self->q_->try_cancel(self);
+			}
+		};
+		struct resume_fn {
+			void operator()(auto *cr) {
+				auto self = frg::container_of(cr, &get_operation::cr_);
+				execution::set_value(self->r_, std::move(self->value));
+			}
+		};
+
+		void complete() override {
+			cr_.complete();
+		}
+
+		persistent_queue *q_;
+		cancellation_token ct_;
+		Receiver r_;
+		cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+	};
+
+	struct get_sender {
+		using value_type = frg::optional<T>;
+
+		template<typename Receiver>
+		friend get_operation<Receiver> connect(get_sender s, Receiver r) {
+			return {s.q, s.ct, std::move(r)};
+		}
+
+		friend sender_awaiter<get_sender, frg::optional<T>> operator co_await (get_sender s) {
+			return {s};
+		}
+
+		persistent_queue *q;
+		cancellation_token ct;
+	};
+
+	get_sender async_get(cancellation_token ct = {}) {
+		return {this, ct};
+	}
+
+	bool empty() {
+		frg::unique_lock lock{mutex_};
+		return empty_();
+	}
+
+	frg::optional<T> maybe_get() {
+		frg::optional<T> object;
+		segment *retired = nullptr;
+		{
+			frg::unique_lock lock{mutex_};
+
+			if(empty_())
+				return {};
+			object = pop_front_(retired);
+		}
+
+		if(retired)
+			destroy_segment_(retired);
+		return object;
+	}
+
+private:
+	std::string directory_;
+	size_t memory_capacity_;
+	size_t segment_size_;
+	size_t records_per_segment_;
+	Allocator allocator_;
+
+	platform::mutex mutex_;
+
+	queue_details_::chunked_deque<T, Allocator> buffer_;
+	size_t in_memory_ = 0;
+
+	// Empty segment that is reused before a new segment is created.
+	segment *spare_ = nullptr;
+
+	// Items that did not fit into buffer_, oldest segment first.
+	frg::intrusive_list<
+		segment,
+		frg::locate_member<
+			segment,
+			frg::default_list_hook<segment>,
+			&segment::hook
+		>
+	> segments_;
+
+	frg::intrusive_list<
+		sink,
+		frg::locate_member<
+			sink,
+			frg::default_list_hook<sink>,
+			&sink::hook_
+		>
+	> sinks_;
+};
+
+} // namespace async
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <functional>
+
+#include <async/basic.hpp>
+#include <async/cancellation.hpp>
+#include <frg/container_of.hpp>
+#include <frg/list.hpp>
+#include <frg/optional.hpp>
+#include <frg/vector.hpp>
+
+namespace async {
+
+// Like queue, but items are returned in order of priority (i.e., the greatest item
+// according to Compare first). Items are kept in a 4-ary heap; hence, insertion and
+// removal take O(log n) time. Items of equal priority are not necessarily FIFO.
+template<typename T, typename Allocator, typename Compare = std::less<T>>
+struct priority_queue {
+	priority_queue(Allocator allocator = {}, Compare compare = {})
+	: heap_{std::move(allocator)}, compare_{std::move(compare)} {}
+
+private:
+	static constexpr size_t arity = 4;
+
+	struct sink {
+		friend struct priority_queue;
+
+	protected:
+		virtual ~sink() = default;
+
+	public:
+		virtual void complete() = 0;
+
+	protected:
+		frg::optional<T> value;
+
+	private:
+		frg::default_list_hook<sink> hook_;
+	};
+
+	bool try_cancel(sink *sp) {
+		frg::unique_lock lock{mutex_};
+
+		if(!sp->value) {
+			auto it = sinks_.iterator_to(sp);
+			sinks_.erase(it);
+			return true;
+		}
+		return false;
+	}
+
+	// Moves the item at index i towards the root until the heap property holds.
+	void sift_up_(size_t i) {
+		T object = std::move(heap_[i]);
+		while(i) {
+			auto parent = (i - 1) / arity;
+			if(!compare_(heap_[parent], object))
+				break;
+			heap_[i] = std::move(heap_[parent]);
+			i = parent;
+		}
+		heap_[i] = std::move(object);
+	}
+
+	// Moves the item at index i towards the leaves until the heap property holds.
+	void sift_down_(size_t i) {
+		auto n = heap_.size();
+		T object = std::move(heap_[i]);
+		while(true) {
+			auto first = i * arity + 1;
+			if(first >= n)
+				break;
+			auto best = first;
+			for(size_t c = first + 1; c < first + arity && c < n; c++) {
+				if(compare_(heap_[best], heap_[c]))
+					best = c;
+			}
+			if(!compare_(object, heap_[best]))
+				break;
+			heap_[i] = std::move(heap_[best]);
+			i = best;
+		}
+		heap_[i] = std::move(object);
+	}
+
+	// Removes the greatest item from the heap. Must be called with mutex_ held.
+	T pop_top_() {
+		T object = std::move(heap_[0]);
+		T last = heap_.pop();
+		if(!heap_.empty()) {
+			heap_[0] = std::move(last);
+			sift_down_(0);
+		}
+		return object;
+	}
+
+public:
+	void put(T item) {
+		emplace(std::move(item));
+	}
+
+	template<typename... Ts>
+	void emplace(Ts&&... arg) {
+		sink *complete_sp = nullptr;
+		{
+			frg::unique_lock lock{mutex_};
+
+			if(!sinks_.empty()) {
+				assert(heap_.empty());
+				auto sp = sinks_.pop_front();
+				sp->value.emplace(std::forward<Ts>(arg)...);
+				complete_sp = sp;
+			}else{
+				heap_.emplace_back(std::forward<Ts>(arg)...);
+				sift_up_(heap_.size() - 1);
+			}
+		}
+
+		if(complete_sp)
+			complete_sp->complete();
+	}
+
+	// ----------------------------------------------------------------------------------
+	// async_get() and its boilerplate.
+	// ----------------------------------------------------------------------------------
+
+	template<typename Receiver>
+	struct get_operation final : private sink {
+		get_operation(priority_queue *q, cancellation_token ct, Receiver r)
+		: q_{q}, ct_{std::move(ct)}, r_{std::move(r)} { }
+
+		void start() {
+			bool fast_path = false;
+			{
+				frg::unique_lock lock{q_->mutex_};
+
+				if(!q_->heap_.empty()) {
+					assert(q_->sinks_.empty());
+					value = q_->pop_top_();
+					fast_path = true;
+				}else{
+					q_->sinks_.push_back(this);
+				}
+			}
+
+			if(fast_path)
+				return execution::set_value(r_, std::move(value));
+			cr_.listen(ct_);
+		}
+
+	private:
+		using sink::value;
+
+		struct try_cancel_fn {
+			bool operator()(auto *cr) {
+				auto self = frg::container_of(cr, &get_operation::cr_);
+				return self->q_->try_cancel(self);
+			}
+		};
+		struct resume_fn {
+			void operator()(auto *cr) {
+				auto self = frg::container_of(cr, &get_operation::cr_);
+				execution::set_value(self->r_, std::move(self->value));
+			}
+		};
+
+		void complete() override {
+			cr_.complete();
+		}
+
+		priority_queue *q_;
+		cancellation_token ct_;
+		Receiver r_;
+		cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+	};
+
+	struct get_sender {
+		using value_type = frg::optional<T>;
+
+		template<typename Receiver>
+		friend get_operation<Receiver> connect(get_sender s, Receiver r) {
+			return {s.q, s.ct, std::move(r)};
+		}
+
+		friend sender_awaiter<get_sender, frg::optional<T>> operator co_await (get_sender s) {
+			return {s};
+		}
+
+		priority_queue *q;
+		cancellation_token ct;
+	};
+
+	get_sender async_get(cancellation_token ct = {}) {
+		return {this, ct};
+	}
+
+	bool empty() {
+		frg::unique_lock lock{mutex_};
+		return heap_.empty();
+	}
+
+	frg::optional<T> maybe_get() {
+		frg::unique_lock lock{mutex_};
+
+		if(heap_.empty())
+			return {};
+		return pop_top_();
+	}
+
+private:
+	platform::mutex mutex_;
+
+	frg::vector<T, Allocator> heap_;
+	Compare compare_;
+
+	frg::intrusive_list<
+		sink,
+		frg::locate_member<
+			sink,
+			frg::default_list_hook<sink>,
+			&sink::hook_
+		>
+	> sinks_;
+};
+
+} // namespace async
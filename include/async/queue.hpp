@@ -1,18 +1,149 @@
 #pragma once
 
+#include <span>
+
 #include <async/basic.hpp>
 #include <async/cancellation.hpp>
+#include <async/select.hpp>
 #include <frg/container_of.hpp>
 #include <frg/list.hpp>
+#include <frg/manual_box.hpp>
 #include <frg/optional.hpp>
 
 namespace async {
 
+namespace queue_details_ {
+
+// FIFO buffer that stores items in fixed-size blocks of contiguous storage.
+// Blocks that run empty are kept on a freelist and reused, hence a queue that does
+// not grow beyond its previous size does not allocate.
+template<typename T, typename Allocator>
+struct chunked_deque {
+	static constexpr size_t block_size = 512 / sizeof(T) > 8 ? 512 / sizeof(T) : 8;
+
+	// Maximal number of empty blocks that are kept for reuse.
+	static constexpr size_t max_free_blocks = 4;
+
+private:
+	struct block {
+		block *next = nullptr;
+		frg::manual_box<T> items[block_size];
+	};
+
+public:
+	chunked_deque(Allocator allocator)
+	: allocator_{std::move(allocator)} { }
+
+	chunked_deque(const chunked_deque &) = delete;
+
+	chunked_deque &operator= (const chunked_deque &) = delete;
+
+	~chunked_deque() {
+		while(!empty())
+			pop_front();
+		// At this point, head_ == tail_ is the only block that is in use.
+		if(head_)
+			frg::destruct(allocator_, head_);
+		while(free_) {
+			auto b = free_;
+			free_ = b->next;
+			frg::destruct(allocator_, b);
+		}
+	}
+
+	bool empty() {
+		return head_ == tail_ && head_index_ == tail_index_;
+	}
+
+	T &front() {
+		assert(!empty());
+		return *head_->items[head_index_];
+	}
+
+	template<typename... Ts>
+	T &emplace_back(Ts&&... arg) {
+		if(!tail_) {
+			head_ = tail_ = acquire_();
+		}else if(tail_index_ == block_size) {
+			auto b = acquire_();
+			tail_->next = b;
+			tail_ = b;
+			tail_index_ = 0;
+		}
+
+		auto &slot = tail_->items[tail_index_];
+		slot.construct(std::forward<Ts>(arg)...);
+		++tail_index_;
+		return *slot;
+	}
+
+	void pop_front() {
+		assert(!empty());
+		head_->items[head_index_].destruct();
+		++head_index_;
+
+		if(head_ == tail_ && head_index_ == tail_index_) {
+			// Rewind instead of moving on to a new block.
+			head_index_ = 0;
+			tail_index_ = 0;
+		}else if(head_index_ == block_size) {
+			auto b = head_;
+			head_ = b->next;
+			head_index_ = 0;
+			recycle_(b);
+		}
+	}
+
+private:
+	block *acquire_() {
+		if(!free_)
+			return frg::construct<block>(allocator_);
+		auto b = free_;
+		free_ = b->next;
+		b->next = nullptr;
+		--num_free_;
+		return b;
+	}
+
+	void recycle_(block *b) {
+		if(num_free_ == max_free_blocks) {
+			frg::destruct(allocator_, b);
+			return;
+		}
+		b->next = free_;
+		free_ = b;
+		++num_free_;
+	}
+
+	Allocator allocator_;
+
+	// Items live in the blocks from head_ to tail_, starting at head_index_ in head_
+	// and ending before tail_index_ in tail_.
+	block *head_ = nullptr;
+	block *tail_ = nullptr;
+	size_t head_index_ = 0;
+	size_t tail_index_ = 0;
+
+	// Singly linked list of empty blocks.
+	block *free_ = nullptr;
+	size_t num_free_ = 0;
+};
+
+} // namespace queue_details_
+
 template<typename T, typename Allocator>
 struct queue {
+	static constexpr size_t unbounded = static_cast<size_t>(-1);
+
 	queue(Allocator allocator = {})
 	: buffer_{allocator} {}
 
+	// async_put() waits while the queue holds capacity items.
+	explicit queue(size_t capacity, Allocator allocator = {})
+	: buffer_{allocator}, capacity_{capacity} {
+		assert(capacity_ > 0);
+	}
+
 private:
 	struct sink {
 		friend struct queue;
@@ -24,16 +155,61 @@ private:
 		virtual void complete() = 0;
 
 	protected:
+		// Set for async_get_batch(); otherwise, the item is stored in value.
+		std::span<T> batch;
+		// Number of items that were handed to the sink.
+		size_t count = 0;
 		frg::optional<T> value;
 
+		// Set for arms of a selector (see select_arm).
+		select_waiter *sel = nullptr;
+		size_t sel_index = 0;
+		bool linked = false;
+
 	private:
 		frg::default_list_hook<sink> hook_;
 	};
 
+	using sink_list = frg::intrusive_list<
+		sink,
+		frg::locate_member<
+			sink,
+			frg::default_list_hook<sink>,
+			&sink::hook_
+		>
+	>;
+
+	// Producer that waits for space in the queue.
+	struct source {
+		friend struct queue;
+
+	protected:
+		virtual ~source() = default;
+
+	public:
+		virtual void complete() = 0;
+
+	protected:
+		// Reset once the item was inserted into the queue.
+		frg::optional<T> value;
+
+	private:
+		frg::default_list_hook<source> hook_;
+	};
+
+	using source_list = frg::intrusive_list<
+		source,
+		frg::locate_member<
+			source,
+			frg::default_list_hook<source>,
+			&source::hook_
+		>
+	>;
+
 	bool try_cancel(sink *sp) {
 		frg::unique_lock lock{mutex_};
 
-		if(!sp->value) {
+		if(!sp->count) {
 			auto it = sinks_.iterator_to(sp);
 			sinks_.erase(it);
 			return true;
@@ -41,6 +217,69 @@ private:
 		return false;
 	}
 
+	bool try_cancel(source *sp) {
+		frg::unique_lock lock{mutex_};
+
+		if(sp->value) {
+			auto it = sources_.iterator_to(sp);
+			sources_.erase(it);
+			return true;
+		}
+		return false;
+	}
+
+	// Removes the front item from buffer_. Must be called with mutex_ held.
+	// If a producer waits for space, its item is moved into the queue and the producer
+	// is added to refills; the caller must complete it after releasing mutex_.
+	T pop_front_(source_list &refills) {
+		auto object = std::move(buffer_.front());
+		buffer_.pop_front();
+		--size_;
+
+		if(!sources_.empty() && size_ < capacity_) {
+			auto sp = sources_.pop_front();
+			buffer_.emplace_back(std::move(*sp->value));
+			sp->value.reset();
+			++size_;
+			refills.push_back(sp);
+		}
+		return object;
+	}
+
+	// Hands an item to a sink. Must be called with mutex_ held.
+	// Returns true if the sink cannot take more items.
+	template<typename... Ts>
+	static bool deliver_(sink *sp, Ts&&... arg) {
+		if(sp->batch.empty()) {
+			sp->value.emplace(std::forward<Ts>(arg)...);
+			sp->count = 1;
+			return true;
+		}
+		sp->batch[sp->count++] = T(std::forward<Ts>(arg)...);
+		return sp->count == sp->batch.size();
+	}
+
+	// Returns the front sink, or nullptr if there is none. Must be called with mutex_ held.
+	// Arms of selectors that already fired (or were cancelled) are dropped on the way;
+	// the caller must hand an item to the returned sink.
+	sink *claim_sink_() {
+		while(!sinks_.empty()) {
+			auto sp = sinks_.front();
+			if(!sp->sel)
+				return sp;
+			sp->linked = false;
+			if(sp->sel->try_claim(sp->sel_index))
+				return sp;
+			sinks_.pop_front();
+		}
+		return nullptr;
+	}
+
+	static void complete_all_(source_list &refills) {
+		while(!refills.empty())
+			refills.pop_front()->complete();
+	}
+
 public:
 	void put(T item) {
 		emplace(std::move(item));
@@ -52,13 +291,14 @@ public:
 		{
 			frg::unique_lock lock{mutex_};
 
-			if(!sinks_.empty()) {
+			if(auto sp = claim_sink_(); sp) {
 				assert(buffer_.empty());
-				auto sp = sinks_.pop_front();
-				sp->value.emplace(std::forward<Ts>(arg)...);
+				sinks_.pop_front();
+				deliver_(sp, std::forward<Ts>(arg)...);
 				complete_sp = sp;
 			}else{
 				buffer_.emplace_back(std::forward<Ts>(arg)...);
+				++size_;
 			}
 		}
 
@@ -66,6 +306,133 @@ public:
 			complete_sp->complete();
 	}
 
+	// Inserts all items (moving from them) while taking the lock only once.
+	// Like put(), this does not respect the capacity of the queue.
+	void put_range(std::span<T> items) {
+		sink_list pending;
+		{
+			frg::unique_lock lock{mutex_};
+
+			size_t i = 0;
+			sink *sp;
+			// Front sink that took some items without being full.
+			sink *partial = nullptr;
+			while(i < items.size() && (sp = claim_sink_())) {
+				assert(buffer_.empty());
+				if(deliver_(sp, std::move(items[i++]))) {
+					sinks_.pop_front();
+					pending.push_back(sp);
+					partial = nullptr;
+				}else{
+					partial = sp;
+				}
+			}
+			if(partial) {
+				assert(sinks_.front() == partial);
+				pending.push_back(sinks_.pop_front());
+			}
+
+			for(; i < items.size(); i++) {
+				buffer_.emplace_back(std::move(items[i]));
+				++size_;
+			}
+		}
+
+		while(!pending.empty())
+			pending.pop_front()->complete();
+	}
+
+	// ----------------------------------------------------------------------------------
+	// async_put() and its boilerplate.
+	// ----------------------------------------------------------------------------------
+
+	template<typename Receiver>
+	struct put_operation final : private source {
+		put_operation(queue *q, T item, cancellation_token ct, Receiver r)
+		: q_{q}, ct_{std::move(ct)}, r_{std::move(r)} {
+			value.emplace(std::move(item));
+		}
+
+		void start() {
+			sink *complete_sp = nullptr;
+			bool fast_path = false;
+			{
+				frg::unique_lock lock{q_->mutex_};
+
+				if(auto sp = q_->claim_sink_(); sp) {
+					assert(q_->buffer_.empty());
+					complete_sp = q_->sinks_.pop_front();
+					deliver_(complete_sp, std::move(*value));
+					fast_path = true;
+				}else if(q_->size_ < q_->capacity_) {
+					// Do not overtake producers that are already waiting.
+					assert(q_->sources_.empty());
+					q_->buffer_.emplace_back(std::move(*value));
+					++q_->size_;
+					fast_path = true;
+				}else{
+					q_->sources_.push_back(this);
+				}
+			}
+
+			if(complete_sp)
+				complete_sp->complete();
+			if(fast_path) {
+				value.reset();
+				return execution::set_value(r_, true);
+			}
+			cr_.listen(ct_);
+		}
+
+	private:
+		using source::value;
+
+		struct try_cancel_fn {
+			bool operator()(auto *cr) {
+				auto self = frg::container_of(cr, &put_operation::cr_);
+				return self->q_->try_cancel(self);
+			}
+		};
+		struct resume_fn {
+			void operator()(auto *cr) {
+				auto self = frg::container_of(cr, &put_operation::cr_);
+				execution::set_value(self->r_, !self->value);
+			}
+		};
+
+		void complete() override {
+			cr_.complete();
+		}
+
+		queue *q_;
+		cancellation_token ct_;
+		Receiver r_;
+		cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+	};
+
+	struct put_sender {
+		using value_type = bool;
+
+		template<typename Receiver>
+		friend put_operation<Receiver> connect(put_sender s, Receiver r) {
+			return {s.q, std::move(s.item), s.ct, std::move(r)};
+		}
+
+		friend sender_awaiter<put_sender, bool> operator co_await (put_sender s) {
+			return {std::move(s)};
+		}
+
+		queue *q;
+		T item;
+		cancellation_token ct;
+	};
+
+	// Inserts item once the queue holds less than capacity items. Completes with false
+	// (and discards item) if the operation was cancelled before that.
+	put_sender async_put(T item, cancellation_token ct = {}) {
+		return {this, std::move(item), ct};
+	}
+
 	// ----------------------------------------------------------------------------------
 	// async_get() and its boilerplate.
 	// ----------------------------------------------------------------------------------
@@ -77,19 +444,20 @@ public:
 
 		void start() {
 			bool fast_path = false;
+			source_list refills;
 			{
 				frg::unique_lock lock{q_->mutex_};
 
 				if(!q_->buffer_.empty()) {
 					assert(q_->sinks_.empty());
-					value = std::move(q_->buffer_.front());
-					q_->buffer_.pop_front();
+					value = q_->pop_front_(refills);
 					fast_path = true;
 				}else{
 					q_->sinks_.push_back(this);
 				}
 			}
 
+			complete_all_(refills);
 			if(fast_path)
 				return execution::set_value(r_, std::move(value));
 			cr_.listen(ct_);
@@ -141,33 +509,201 @@ public:
 		return {this, ct};
 	}
 
+	// ----------------------------------------------------------------------------------
+	// async_get_batch() and its boilerplate.
+	// ----------------------------------------------------------------------------------
+
+	template<typename Receiver>
+	struct get_batch_operation final : private sink {
+		get_batch_operation(queue *q, std::span<T> out, cancellation_token ct, Receiver r)
+		: q_{q}, ct_{std::move(ct)}, r_{std::move(r)} {
+			batch = out;
+		}
+
+		void start() {
+			// An empty batch would be mistaken for a sink of async_get().
+			if(batch.empty())
+				return execution::set_value(r_, size_t{0});
+
+			bool fast_path = false;
+			source_list refills;
+			{
+				frg::unique_lock lock{q_->mutex_};
+
+				if(!q_->buffer_.empty()) {
+					assert(q_->sinks_.empty());
+					while(count < batch.size() && !q_->buffer_.empty())
+						batch[count++] = q_->pop_front_(refills);
+					fast_path = true;
+				}else{
+					q_->sinks_.push_back(this);
+				}
+			}
+
+			complete_all_(refills);
+			if(fast_path)
+				return execution::set_value(r_, count);
+			cr_.listen(ct_);
+		}
+
+	private:
+		using sink::batch;
+		using sink::count;
+
+		struct try_cancel_fn {
+			bool operator()(auto *cr) {
+				auto self = frg::container_of(cr, &get_batch_operation::cr_);
+				return self->q_->try_cancel(self);
+			}
+		};
+		struct resume_fn {
+			void operator()(auto *cr) {
+				auto self = frg::container_of(cr, &get_batch_operation::cr_);
+				execution::set_value(self->r_, self->count);
+			}
+		};
+
+		void complete() override {
+			cr_.complete();
+		}
+
+		queue *q_;
+		cancellation_token ct_;
+		Receiver r_;
+		cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+	};
+
+	struct get_batch_sender {
+		using value_type = size_t;
+
+		template<typename Receiver>
+		friend get_batch_operation<Receiver> connect(get_batch_sender s, Receiver r) {
+			return {s.q, s.out, s.ct, std::move(r)};
+		}
+
+		friend sender_awaiter<get_batch_sender, size_t> operator co_await (get_batch_sender s) {
+			return {s};
+		}
+
+		queue *q;
+		std::span<T> out;
+		cancellation_token ct;
+	};
+
+	// Waits until the queue is non-empty, then moves up to out.size() items into out
+	// while taking the lock only once. Completes with the number of items (or zero if
+	// the operation was cancelled). If out is empty, completes immediately with zero.
+	get_batch_sender async_get_batch(std::span<T> out, cancellation_token ct = {}) {
+		return {this, out, ct};
+	}
+
+	// ----------------------------------------------------------------------------------
+	// Support for selector.
+	// ----------------------------------------------------------------------------------
+
+	// Arm of a selector that receives one item per async_select().
+	struct select_arm final : private sink {
+		friend struct queue;
+
+		select_arm(queue &q)
+		: q_{&q} { }
+
+		select_arm(const select_arm &) = delete;
+
+		select_arm &operator= (const select_arm &) = delete;
+
+		void link(select_waiter *w, size_t index) {
+			bool fast_path = false;
+			source_list refills;
+			{
+				frg::unique_lock lock{q_->mutex_};
+
+				sel = w;
+				sel_index = index;
+				if(!linked) {
+					// Drop the item of the previous async_select() if it was not taken.
+					count = 0;
+					value.reset();
+				}
+				if(!q_->buffer_.empty()) {
+					assert(q_->sinks_.empty());
+					if(!w->try_claim(index))
+						return;
+					value = q_->pop_front_(refills);
+					fast_path = true;
+				}else if(!linked) {
+					// Otherwise, the arm is still linked from a previous async_select().
+					q_->sinks_.push_back(this);
+					linked = true;
+				}
+			}
+
+			complete_all_(refills);
+			if(fast_path)
+				w->complete();
+		}
+
+		void unlink() {
+			frg::unique_lock lock{q_->mutex_};
+
+			if(linked) {
+				q_->sinks_.erase(q_->sinks_.iterator_to(this));
+				linked = false;
+			}
+		}
+
+		// Moves out the item after async_select() returned the index of this arm.
+		T take() {
+			assert(value);
+			T object = std::move(*value);
+			value.reset();
+			return object;
+		}
+
+	private:
+		using sink::count;
+		using sink::value;
+		using sink::sel;
+		using sink::sel_index;
+		using sink::linked;
+
+		void complete() override {
+			sel->complete();
+		}
+
+		queue *q_;
+	};
+
 	bool empty() {
 		return buffer_.empty();
 	}
 
 	frg::optional<T> maybe_get() {
-		frg::unique_lock lock{mutex_};
+		frg::optional<T> object;
+		source_list refills;
+		{
+			frg::unique_lock lock{mutex_};
 
-		if(buffer_.empty())
-			return {};
-		auto object = std::move(buffer_.front());
-		buffer_.pop_front();
+			if(buffer_.empty())
+				return {};
+			object = pop_front_(refills);
+		}
+
+		complete_all_(refills);
 		return object;
 	}
 
 private:
 	platform::mutex mutex_;
 
-	frg::list<T, Allocator> buffer_;
+	queue_details_::chunked_deque<T, Allocator> buffer_;
+	size_t size_ = 0;
+	size_t capacity_ = unbounded;
 
-	frg::intrusive_list<
-		sink,
-		frg::locate_member<
-			sink,
-			frg::default_list_hook<sink>,
-			&sink::hook_
-		>
-	> sinks_;
+	sink_list sinks_;
+
+	// Producers that wait for space. Non-empty only if the queue is full.
+	source_list sources_;
 };
 
 } // namespace async
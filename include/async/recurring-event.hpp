@@ -3,6 +3,7 @@
 #include <async/algorithm.hpp>
 #include <async/basic.hpp>
 #include <async/cancellation.hpp>
+#include <async/select.hpp>
 #include <frg/expected.hpp>
 #include <frg/container_of.hpp>
 #include <frg/list.hpp>
@@ -40,6 +41,9 @@ private:
 		frg::default_list_hook<node> _hook;
 		// The submitted -> pending transition is protected by _mutex.
 		state st_;
+		// Set for arms of a selector (see select_arm).
+		select_waiter *sel_ = nullptr;
+		size_t sel_index_ = 0;
 	};
 
 public:
@@ -56,10 +60,16 @@ public:
 		{
 			frg::unique_lock lock(_mutex);
 
-			items.splice(items.end(), queue_);
-			for(auto item : items) {
+			while(!queue_.empty()) {
+				auto item = queue_.pop_front();
 				assert(item->st_ == state::submitted);
+				// Drop arms of selectors that already fired (or were cancelled).
+				if(item->sel_ && !item->sel_->try_claim(item->sel_index_)) {
+					item->st_ = state::none;
+					continue;
+				}
 				item->st_ = state::pending;
+				items.push_back(item);
 			}
 		}
 
@@ -187,6 +197,46 @@ public:
 		});
 	}
 
+	// ----------------------------------------------------------------------------------
+	// Support for selector.
+	// ----------------------------------------------------------------------------------
+
+	// Arm of a selector. Like async_wait(), it only observes raise() calls that happen
+	// while async_select() is pending.
+	struct select_arm final : private node {
+		select_arm(recurring_event &evt)
+		: evt_{&evt} { }
+
+		void link(select_waiter *w, size_t index) {
+			frg::unique_lock lock(evt_->_mutex);
+
+			sel_ = w;
+			sel_index_ = index;
+			// Otherwise, the arm is still linked from a previous async_select().
+			if(st_ != state::submitted) {
+				st_ = state::submitted;
+				evt_->queue_.push_back(this);
+			}
+		}
+
+		void unlink() {
+			frg::unique_lock lock(evt_->_mutex);
+
+			if(st_ == state::submitted) {
+				st_ = state::none;
+				auto it = evt_->queue_.iterator_to(this);
+				evt_->queue_.erase(it);
+			}
+		}
+
+	private:
+		void complete() override {
+			sel_->complete();
+		}
+
+		recurring_event *evt_;
+	};
+
 private:
 	platform::mutex _mutex;
 
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#include <async/basic.hpp>
+#include <async/cancellation.hpp>
+#include <frg/container_of.hpp>
+#include <frg/optional.hpp>
+
+namespace async {
+
+// Waiter that is shared by all arms of a selector. Sources that support selection provide
+// a select_arm type which links itself into the source's list of waiters. When the source
+// fires, it calls try_claim(); the first successful call completes async_select().
+struct select_waiter {
+	select_waiter() = default;
+
+	select_waiter(const select_waiter &) = delete;
+
+	select_waiter &operator= (const select_waiter &) = delete;
+
+	// Called by sources when an arm fires. Returns false if async_select() already
+	// completed (or is about to complete) with a different result; in this case,
+	// the source should drop the arm.
+	bool try_claim(size_t index) {
+		size_t expected = waiting;
+		return state_.compare_exchange_strong(expected, index,
+				std::memory_order_acq_rel, std::memory_order_relaxed);
+	}
+
+	// Must be called once after try_claim() succeeded. Sources must not hold locks here.
+	virtual void complete() = 0;
+
+protected:
+	~select_waiter() = default;
+
+	// Special values of state_. Otherwise, state_ is the index of the arm that fired.
+	static constexpr size_t idle = static_cast<size_t>(-1);
+	static constexpr size_t waiting = static_cast<size_t>(-2);
+	static constexpr size_t cancelled = static_cast<size_t>(-3);
+
+	std::atomic<size_t> state_{idle};
+};
+
+namespace select_details_ {
+	template<size_t I, typename... Sources>
+	struct arm_storage;
+
+	template<size_t I>
+	struct arm_storage<I> { };
+
+	template<size_t I, typename Source, typename... Rest>
+	struct arm_storage<I, Source, Rest...> {
+		arm_storage(Source &source, Rest &... rest)
+		: arm{source}, rest{rest...} { }
+
+		typename Source::select_arm arm;
+		arm_storage<I + 1, Rest...> rest;
+	};
+
+	template<size_t I, size_t J, typename... Sources>
+	auto &get(arm_storage<J, Sources...> &storage) {
+		if constexpr (I == J) {
+			return storage.arm;
+		}else{
+			return get<I>(storage.rest);
+		}
+	}
+} // namespace select_details_
+
+// Waits for the first of multiple sources (e.g., queue, recurring_event or
+// oneshot_primitive) to fire. A selector registers one arm per source; the arms share
+// a single waiter that is claimed by the first source that fires.
+//
+// The selector is meant to be reused for many async_select() calls. Arms that did
+// not fire stay linked to their sources; they are dropped lazily by the source when
+// it fires while the selector is not waiting (and re-linked on the next async_select()).
+template<typename... Sources>
+struct selector final : private select_waiter {
+	static_assert(sizeof...(Sources) > 0);
+
+	selector(Sources &... sources)
+	: arms_{sources...} { }
+
+	~selector() {
+		assert(state_.load(std::memory_order_relaxed) == idle);
+		unlink_all_(std::index_sequence_for<Sources...>{});
+	}
+
+	// Returns the value that source I produced, if async_select() returned I.
+	// Only supported by sources that produce values (e.g., queue).
+	template<size_t I>
+	auto take() {
+		return arm_<I>().take();
+	}
+
+private:
+	struct operation_base {
+		virtual void complete() = 0;
+
+	protected:
+		~operation_base() = default;
+	};
+
+	template<size_t I>
+	auto &arm_() {
+		return select_details_::get<I>(arms_);
+	}
+
+	template<size_t... Is>
+	void link_all_(std::index_sequence<Is...>) {
+		// Stop linking arms once one of them fired.
+		((state_.load(std::memory_order_acquire) == waiting
+				? (arm_<Is>().link(this, Is), 0) : 0), ...);
+	}
+
+	template<size_t... Is>
+	void unlink_all_(std::index_sequence<Is...>) {
+		(arm_<Is>().unlink(), ...);
+	}
+
+	void complete() override {
+		op_->complete();
+	}
+
+public:
+	// ----------------------------------------------------------------------------------
+	// async_select() and its boilerplate.
+	// ----------------------------------------------------------------------------------
+
+	template<typename Receiver>
+	struct select_operation final : private operation_base {
+		select_operation(selector *sel, cancellation_token ct, Receiver r)
+		: sel_{sel}, ct_{std::move(ct)}, r_{std::move(r)} { }
+
+		void start() {
+			assert(sel_->state_.load(std::memory_order_relaxed) == idle);
+			sel_->op_ = this;
+			// Arms that are still linked from previous calls can fire from now on.
+			sel_->state_.store(waiting, std::memory_order_release);
+
+			sel_->link_all_(std::index_sequence_for<Sources...>{});
+			cr_.listen(ct_);
+		}
+
+	private:
+		struct try_cancel_fn {
+			bool operator()(auto *cr) {
+				auto self = frg::container_of(cr, &select_operation::cr_);
+				return self->sel_->try_claim(cancelled);
+			}
+		};
+		struct resume_fn {
+			void operator()(auto *cr) {
+				auto self = frg::container_of(cr, &select_operation::cr_);
+				auto st = self->sel_->state_.load(std::memory_order_acquire);
+				self->sel_->state_.store(idle, std::memory_order_relaxed);
+				if(st == cancelled)
+					execution::set_value(self->r_, frg::optional<size_t>{});
+				else
+					execution::set_value(self->r_, frg::optional<size_t>{st});
+			}
+		};
+
+		void complete() override {
+			cr_.complete();
+		}
+
+		selector *sel_;
+		cancellation_token ct_;
+		Receiver r_;
+		cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+	};
+
+	struct select_sender {
+		using value_type = frg::optional<size_t>;
+
+		template<typename Receiver>
+		friend select_operation<Receiver> connect(select_sender s, Receiver r) {
+			return {s.sel, s.ct, std::move(r)};
+		}
+
+		friend sender_awaiter<select_sender, frg::optional<size_t>> operator co_await (select_sender s) {
+			return {s};
+		}
+
+		selector *sel;
+		cancellation_token ct;
+	};
+
+	// Waits until one of the sources fires and returns its index, or frg::null_opt if
+	// the operation was cancelled. If multiple sources are ready, the first one wins.
+	// At most one async_select() may be pending at any time.
+	select_sender async_select(cancellation_token ct = {}) {
+		return {this, ct};
+	}
+
+private:
+	select_details_::arm_storage<0, Sources...> arms_;
+
+	// Current async_select() operation.
+	operation_base *op_ = nullptr;
+};
+
+template<typename... Sources>
+selector(Sources &...) -> selector<Sources...>;
+
+} // namespace async
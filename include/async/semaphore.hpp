@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <async/basic.hpp>
+#include <async/cancellation.hpp>
+#include <frg/container_of.hpp>
+#include <frg/list.hpp>
+
+namespace async {
+
+struct semaphore {
+private:
+	struct node {
+		friend struct semaphore;
+
+		node() = default;
+
+		node(const node &) = delete;
+
+		node &operator= (const node &) = delete;
+
+		virtual void complete() = 0;
+
+		bool was_granted() const { return granted_; }
+
+	protected:
+		virtual ~node() = default;
+
+		// Number of units requested by this node.
+		size_t n_ = 0;
+
+	private:
+		// Protected by mutex_.
+		frg::default_list_hook<node> hook_;
+		bool granted_ = false;
+	};
+
+	using node_list = frg::intrusive_list<
+		node,
+		frg::locate_member<
+			node,
+			frg::default_list_hook<node>,
+			&node::hook_
+		>
+	>;
+
+public:
+	semaphore(size_t count = 0)
+	: st_{count} {
+		assert(!(count & waiters_bit));
+	}
+
+	// ------------------------------------------------------------------------------
+	// async_acquire and boilerplate.
+	// ------------------------------------------------------------------------------
+
+	template<typename R>
+	struct [[nodiscard]] acquire_operation final : private node {
+		acquire_operation(semaphore *self, size_t n, cancellation_token ct, R receiver)
+		: self_{self}, ct_{std::move(ct)}, receiver_{std::move(receiver)} {
+			node::n_ = n;
+		}
+
+		void start() {
+			// Avoid taking mutex_ if possible.
+			if (self_->try_acquire(node::n_))
+				return execution::set_value(receiver_, true);
+
+			bool fast_path = false;
+			{
+				frg::unique_lock lock(self_->mutex_);
+
+				auto st = self_->st_.load(std::memory_order_relaxed);
+				while (true) {
+					if (!(st & waiters_bit) && st >= node::n_) {
+						bool success = self_->st_.compare_exchange_weak(
+							st,
+							st - node::n_,
+							std::memory_order_acquire,
+							std::memory_order_relaxed
+						);
+						if (success) {
+							fast_path = true;
+							break;
+						}
+					} else if (!(st & waiters_bit)) {
+						// CAS since there can be concurrent transitions while waiters_bit is clear.
+						bool success = self_->st_.compare_exchange_weak(
+							st,
+							st | waiters_bit,
+							std::memory_order_relaxed,
+							std::memory_order_relaxed
+						);
+						if (success) {
+							self_->waiters_.push_back(this);
+							break;
+						}
+					} else {
+						// mutex_ protects against concurrent transitions while waiters_bit is set.
+						self_->waiters_.push_back(this);
+						break;
+					}
+				}
+			}
+
+			if (fast_path)
+				return execution::set_value(receiver_, true);
+			cr_.listen(ct_);
+		}
+
+	private:
+		struct try_cancel_fn {
+			bool operator()(auto *cr) {
+				auto self = frg::container_of(cr, &acquire_operation::cr_);
+				return self->self_->try_cancel_(self);
+			}
+		};
+		struct resume_fn {
+			void operator()(auto *cr) {
+				auto self = frg::container_of(cr, &acquire_operation::cr_);
+				execution::set_value(self->receiver_, self->was_granted());
+			}
+		};
+
+		void complete() override {
+			cr_.complete();
+		}
+
+		semaphore *self_;
+		cancellation_token ct_;
+		R receiver_;
+		cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+	};
+
+	struct [[nodiscard]] acquire_sender {
+		using value_type = bool;
+
+		template<typename R>
+		acquire_operation<R> connect(R receiver) {
+			return {self, n, ct, std::move(receiver)};
+		}
+
+		sender_awaiter<acquire_sender, bool>
+		operator co_await () {
+			return {*this};
+		}
+
+		semaphore *self;
+		size_t n;
+		cancellation_token ct;
+	};
+
+	acquire_sender async_acquire(size_t n = 1, cancellation_token ct = {}) {
+		return {this, n, ct};
+	}
+
+	// ------------------------------------------------------------------------------
+
+	bool try_acquire(size_t n = 1) {
+		auto st = st_.load(std::memory_order_relaxed);
+		while (true) {
+			// Do not overtake waiters, otherwise large requests could starve.
+			if ((st & waiters_bit) || st < n)
+				return false;
+			bool success = st_.compare_exchange_weak(
+				st,
+				st - n,
+				std::memory_order_acquire,
+				std::memory_order_relaxed
+			);
+			if (success)
+				return true;
+		}
+	}
+
+	void release(size_t n = 1) {
+		auto st = st_.load(std::memory_order_relaxed);
+
+		// If there are no waiters, we can release without taking mutex_.
+		while (!(st & waiters_bit)) {
+			assert(!((st + n) & waiters_bit));
+			bool success = st_.compare_exchange_weak(
+				st,
+				st + n,
+				std::memory_order_release,
+				std::memory_order_relaxed
+			);
+			if (success)
+				return;
+		}
+
+		node_list pending;
+		{
+			frg::unique_lock lock(mutex_);
+
+			// mutex_ protects against concurrent transitions while waiters_bit is set.
+			st = st_.load(std::memory_order_relaxed);
+			assert(st & waiters_bit);
+			grant_(st + n, pending);
+		}
+
+		while (!pending.empty())
+			pending.pop_front()->complete();
+	}
+
+private:
+	static constexpr size_t waiters_bit = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+	// Hands out units to waiters in FIFO order and updates st_.
+	// Must be called with mutex_ held and waiters_bit set.
+	void grant_(size_t st, node_list &pending) {
+		size_t count = st & ~waiters_bit;
+		while (!waiters_.empty() && waiters_.front()->n_ <= count) {
+			auto nd = waiters_.pop_front();
+			count -= nd->n_;
+			nd->granted_ = true;
+			pending.push_back(nd);
+		}
+
+		// Hand-off to a waiter does not require a fence.
+		if (waiters_.empty()) {
+			st_.store(count, std::memory_order_release);
+		} else {
+			st_.store(count | waiters_bit, std::memory_order_relaxed);
+		}
+	}
+
+	bool try_cancel_(node *nd) {
+		node_list pending;
+		{
+			frg::unique_lock lock(mutex_);
+
+			if (nd->granted_)
+				return false;
+
+			// Removing the front node may unblock the nodes behind it.
+			bool was_front = waiters_.front() == nd;
+			waiters_.erase(waiters_.iterator_to(nd));
+			if (was_front || waiters_.empty())
+				grant_(st_.load(std::memory_order_relaxed), pending);
+		}
+
+		while (!pending.empty())
+			pending.pop_front()->complete();
+		return true;
+	}
+
+	platform::mutex mutex_;
+
+	// Number of available units. If waiters_bit is set, waiters_ is non-empty.
+	// Transitions that set or clear waiters_bit and all transitions while waiters_bit
+	// is set are protected by mutex_.
+	std::atomic<size_t> st_;
+
+	node_list waiters_;
+};
+
+} // namespace async
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include <async/basic.hpp>
+#include <async/cancellation.hpp>
+#include <frg/container_of.hpp>
+#include <frg/manual_box.hpp>
+#include <frg/optional.hpp>
+
+namespace async {
+
+// Bounded queue for exactly one producer and one consumer, on top of a ring of N slots.
+// The producer only writes tail_ and the consumer only writes head_; both live on separate
+// cache lines together with a cached copy of the other side's index.
+// At most one async_get() operation may be pending at any time.
+template<typename T, size_t N>
+struct spsc_queue {
+	static_assert(N > 0 && !(N & (N - 1)), "N must be a power of two");
+
+private:
+	static constexpr size_t cache_line_size = 64;
+	static constexpr size_t mask = N - 1;
+
+	struct node {
+		friend struct spsc_queue;
+
+		node(void (*complete)(node *))
+		: complete_{complete} { }
+
+		node(const node &) = delete;
+
+		node &operator= (const node &) = delete;
+
+	protected:
+		// Completion function (see oneshot_primitive).
+		void (*complete_)(node *);
+	};
+
+	bool try_cancel(node *nd) {
+		node *expected = nd;
+		return waiter_.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+	}
+
+public:
+	spsc_queue() = default;
+
+	spsc_queue(const spsc_queue &) = delete;
+
+	spsc_queue &operator= (const spsc_queue &) = delete;
+
+	~spsc_queue() {
+		assert(!waiter_.load(std::memory_order_relaxed));
+		while(maybe_get())
+			;
+	}
+
+	// Must only be called by the producer. Returns false if the queue is full.
+	bool try_put(T item) {
+		return try_emplace(std::move(item));
+	}
+
+	template<typename... Ts>
+	bool try_emplace(Ts&&... arg) {
+		auto tail = tail_.load(std::memory_order_relaxed);
+		if(tail - head_cache_ == N) {
+			head_cache_ = head_.load(std::memory_order_acquire);
+			if(tail - head_cache_ == N)
+				return false;
+		}
+
+		slots_[tail & mask].construct(std::forward<Ts>(arg)...);
+		// Pairs with the seq_cst operations in get_operation::start(): either the consumer
+		// observes the new tail, or we observe its waiter.
+		tail_.store(tail + 1, std::memory_order_seq_cst);
+
+		if(waiter_.load(std::memory_order_seq_cst)) {
+			auto nd = waiter_.exchange(nullptr, std::memory_order_acq_rel);
+			if(nd)
+				nd->complete_(nd);
+		}
+		return true;
+	}
+
+	// Must only be called by the consumer.
+	frg::optional<T> maybe_get() {
+		auto head = head_.load(std::memory_order_relaxed);
+		if(head == tail_cache_) {
+			tail_cache_ = tail_.load(std::memory_order_acquire);
+			if(head == tail_cache_)
+				return {};
+		}
+
+		auto &slot = slots_[head & mask];
+		frg::optional<T> object{std::move(*slot)};
+		slot.destruct();
+		head_.store(head + 1, std::memory_order_release);
+		return object;
+	}
+
+	// ----------------------------------------------------------------------------------
+	// async_get() and its boilerplate.
+	// ----------------------------------------------------------------------------------
+
+	template<typename Receiver>
+	struct get_operation final : private node {
+		get_operation(spsc_queue *q, cancellation_token ct, Receiver r)
+		: node{&complete}, q_{q}, ct_{std::move(ct)}, r_{std::move(r)} { }
+
+		void start() {
+			value_ = q_->maybe_get();
+			if(value_)
+				return execution::set_value(r_, std::move(value_));
+
+			assert(!q_->waiter_.load(std::memory_order_relaxed));
+			q_->waiter_.store(this, std::memory_order_seq_cst);
+
+			if(q_->tail_.load(std::memory_order_seq_cst) != q_->head_.load(std::memory_order_relaxed)) {
+				// An item was put concurrently. Unless the producer already took
+				// the waiter (and completes us), we can take the item ourselves.
+				node *expected = this;
+				if(q_->waiter_.compare_exchange_strong(expected, nullptr,
+						std::memory_order_acq_rel)) {
+					value_ = q_->maybe_get();
+					return execution::set_value(r_, std::move(value_));
+				}
+			}
+
+			cr_.listen(ct_);
+		}
+
+	private:
+		struct try_cancel_fn {
+			bool operator()(auto *cr) {
+				auto self = frg::container_of(cr, &get_operation::cr_);
+				return self->q_->try_cancel(self);
+			}
+		};
+		struct resume_fn {
+			void operator()(auto *cr) {
+				auto self = frg::container_of(cr, &get_operation::cr_);
+				execution::set_value(self->r_, std::move(self->value_));
+			}
+		};
+
+		static void complete(node *base) {
+			auto self = static_cast<get_operation *>(base);
+			self->value_ = self->q_->maybe_get();
+			self->cr_.complete();
+		}
+
+		spsc_queue *q_;
+		cancellation_token ct_;
+		Receiver r_;
+		frg::optional<T> value_;
+		cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+	};
+
+	struct get_sender {
+		using value_type = frg::optional<T>;
+
+		template<typename Receiver>
+		friend get_operation<Receiver> connect(get_sender s, Receiver r) {
+			return {s.q, s.ct, std::move(r)};
+		}
+
+		friend sender_awaiter<get_sender, frg::optional<T>> operator co_await (get_sender s) {
+			return {s};
+		}
+
+		spsc_queue *q;
+		cancellation_token ct;
+	};
+
+	// Must only be called by the consumer.
+	get_sender async_get(cancellation_token ct = {}) {
+		return {this, ct};
+	}
+
+private:
+	// Written by the producer.
+	alignas(cache_line_size) std::atomic<size_t> tail_{0};
+	size_t head_cache_{0};
+
+	// Written by the consumer.
+	alignas(cache_line_size) std::atomic<size_t> head_{0};
+	size_t tail_cache_{0};
+
+	// Pending async_get() operation (if any).
+	alignas(cache_line_size) std::atomic<node *> waiter_{nullptr};
+
+	alignas(cache_line_size) frg::manual_box<T> slots_[N];
+};
+
+} // namespace async
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#include <async/basic.hpp>
+#include <async/cancellation.hpp>
+#include <frg/container_of.hpp>
+#include <frg/list.hpp>
+#include <frg/optional.hpp>
+
+namespace async {
+
+// Holds the latest value of some state (e.g., a configuration) and lets readers wait
+// for changes. Values are immutable, reference-counted snapshots: an update allocates
+// a new snapshot and swaps it in, while readers keep using their old snapshots.
+// Each update increments the sequence number of the watch.
+//
+// current() does not take the lock. It uses split reference counts: the pointer to the
+// current snapshot is packed with an external count that readers increment to pin
+// the snapshot while they acquire a reference on it. When an update swaps the pointer,
+// it transfers the external count to the old snapshot's own counter.
+template<typename T, typename Allocator>
+struct watch {
+	static_assert(sizeof(uintptr_t) == 8, "watch packs pointers into 48 bits");
+
+private:
+	struct box {
+		template<typename... Ts>
+		box(Allocator allocator, Ts&&... arg)
+		: allocator{std::move(allocator)}, value(std::forward<Ts>(arg)...) { }
+
+		std::atomic<size_t> refs{1};
+		Allocator allocator;
+		// Sequence number of this value. Written before the box is published.
+		uint64_t seq = 0;
+		const T value;
+	};
+
+	// Layout of current_: the external count is stored above the pointer bits.
+	static constexpr int ext_shift = 48;
+	static constexpr uintptr_t ext_one = uintptr_t{1} << ext_shift;
+	static constexpr uintptr_t ptr_mask = ext_one - 1;
+
+	static uintptr_t pack_(box *bx) {
+		auto p = reinterpret_cast<uintptr_t>(bx);
+		assert(!(p & ~ptr_mask));
+		return p;
+	}
+
+	static box *unpack_(uintptr_t word) {
+		return reinterpret_cast<box *>(word & ptr_mask);
+	}
+
+	static void release_(box *bx) {
+		if(bx->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			auto allocator = bx->allocator;
+			frg::destruct(allocator, bx);
+		}
+	}
+
+public:
+	// Reference to an immutable value of the watch.
+	struct snapshot {
+		friend struct watch;
+
+		snapshot() = default;
+
+		snapshot(const snapshot &other)
+		: bx_{other.bx_} {
+			if(bx_)
+				bx_->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		snapshot(snapshot &&other)
+		: bx_{std::exchange(other.bx_, nullptr)} { }
+
+		~snapshot() {
+			if(bx_)
+				release_(bx_);
+		}
+
+		snapshot &operator= (snapshot other) {
+			std::swap(bx_, other.bx_);
+			return *this;
+		}
+
+		explicit operator bool () const {
+			return bx_;
+		}
+
+		const T &operator* () const {
+			return bx_->value;
+		}
+
+		const T *operator-> () const {
+			return &bx_->value;
+		}
+
+	private:
+		explicit snapshot(box *bx)
+		: bx_{bx} { }
+
+		box *bx_ = nullptr;
+	};
+
+	struct update {
+		uint64_t seq;
+		snapshot value;
+	};
+
+private:
+	struct node {
+		friend struct watch;
+
+	protected:
+		virtual ~node() = default;
+
+	public:
+		virtual void complete() = 0;
+
+	protected:
+		uint64_t seq;
+		// Set once the node is removed from waiters_.
+		frg::optional<update> result;
+
+	private:
+		frg::default_list_hook<node> hook_;
+	};
+
+	using node_list = frg::intrusive_list<
+		node,
+		frg::locate_member<
+			node,
+			frg::default_list_hook<node>,
+			&node::hook_
+		>
+	>;
+
+	bool try_cancel(node *nd) {
+		frg::unique_lock lock{mutex_};
+
+		if(!nd->result) {
+			waiters_.erase(waiters_.iterator_to(nd));
+			nd->result = current_locked_();
+			return true;
+		}
+		return false;
+	}
+
+	// Must be called with mutex_ held. Since emplace() cannot swap the pointer
+	// concurrently, the external count is not needed here.
+	update current_locked_() {
+		auto bx = unpack_(current_.load(std::memory_order_relaxed));
+		bx->refs.fetch_add(1, std::memory_order_relaxed);
+		return {bx->seq, snapshot{bx}};
+	}
+
+	// Must be called with mutex_ held.
+	uint64_t current_seq_() {
+		return unpack_(current_.load(std::memory_order_relaxed))->seq;
+	}
+
+public:
+	watch(T initial, Allocator allocator = {})
+	: allocator_{std::move(allocator)} {
+		current_.store(pack_(frg::construct<box>(allocator_, allocator_, std::move(initial))),
+				std::memory_order_relaxed);
+	}
+
+	watch(const watch &) = delete;
+
+	watch &operator= (const watch &) = delete;
+
+	~watch() {
+		assert(waiters_.empty());
+		auto word = current_.load(std::memory_order_relaxed);
+		assert(!(word & ~ptr_mask));
+		release_(unpack_(word));
+	}
+
+	void set(T value) {
+		emplace(std::move(value));
+	}
+
+	template<typename... Ts>
+	void emplace(Ts&&... arg) {
+		// Construct the new snapshot outside of the lock.
+		auto bx = frg::construct<box>(allocator_, allocator_, std::forward<Ts>(arg)...);
+
+		uintptr_t old;
+		node_list pending;
+		{
+			frg::unique_lock lock{mutex_};
+
+			bx->seq = current_seq_() + 1;
+			old = current_.exchange(pack_(bx), std::memory_order_acq_rel);
+
+			pending.splice(pending.end(), waiters_);
+			for(auto nd : pending)
+				nd->result = current_locked_();
+		}
+
+		// Readers that still hold external references now own references on the box.
+		if(auto ext = old >> ext_shift; ext)
+			unpack_(old)->refs.fetch_add(ext, std::memory_order_relaxed);
+		release_(unpack_(old));
+		while(!pending.empty())
+			pending.pop_front()->complete();
+	}
+
+	// Returns the current sequence number together with the corresponding value.
+	// This does not take the lock.
+	update current() {
+		// The external reference keeps the box alive until we own a reference on it.
+		auto word = current_.fetch_add(ext_one, std::memory_order_acquire) + ext_one;
+		auto bx = unpack_(word);
+		bx->refs.fetch_add(1, std::memory_order_relaxed);
+
+		// Give the external reference back. If emplace() swapped the pointer in the
+		// meantime, it transferred the external reference to bx->refs instead.
+		while(true) {
+			if(unpack_(word) != bx) {
+				bx->refs.fetch_sub(1, std::memory_order_relaxed);
+				break;
+			}
+			if(current_.compare_exchange_weak(word, word - ext_one,
+					std::memory_order_relaxed, std::memory_order_relaxed))
+				break;
+		}
+		return {bx->seq, snapshot{bx}};
+	}
+
+	// ----------------------------------------------------------------------------------
+	// async_changed() and its boilerplate.
+	// ----------------------------------------------------------------------------------
+
+	template<typename Receiver>
+	struct changed_operation final : private node {
+		changed_operation(watch *w, uint64_t seq, cancellation_token ct, Receiver r)
+		: w_{w}, ct_{std::move(ct)}, r_{std::move(r)} {
+			this->seq = seq;
+		}
+
+		void start() {
+			bool fast_path = false;
+			{
+				frg::unique_lock lock{w_->mutex_};
+
+				if(seq != w_->current_seq_()) {
+					result = w_->current_locked_();
+					fast_path = true;
+				}else{
+					w_->waiters_.push_back(this);
+				}
+			}
+
+			if(fast_path)
+				return execution::set_value(r_, std::move(*result));
+			cr_.listen(ct_);
+		}
+
+	private:
+		using node::seq;
+		using node::result;
+
+		struct try_cancel_fn {
+			bool operator()(auto *cr) {
+				auto self = frg::container_of(cr, &changed_operation::cr_);
+				return self->w_->try_cancel(self);
+			}
+		};
+		struct resume_fn {
+			void operator()(auto *cr) {
+				auto self = frg::container_of(cr, &changed_operation::cr_);
+				execution::set_value(self->r_, std::move(*self->result));
+			}
+		};
+
+		void complete() override {
+			cr_.complete();
+		}
+
+		watch *w_;
+		cancellation_token ct_;
+		Receiver r_;
+		cancellation_resolver<try_cancel_fn, resume_fn> cr_;
+	};
+
+	struct changed_sender {
+		using value_type = update;
+
+		template<typename Receiver>
+		friend changed_operation<Receiver> connect(changed_sender s, Receiver r) {
+			return {s.w, s.seq, s.ct, std::move(r)};
+		}
+
+		friend sender_awaiter<changed_sender, update> operator co_await (changed_sender s) {
+			return {s};
+		}
+
+		watch *w;
+		uint64_t seq;
+		cancellation_token ct;
+	};
+
+	// Waits until the sequence number of the watch differs from seq; then returns
+	// the current sequence number and value. On cancellation, the result is the same
+	// as for current().
+	changed_sender async_changed(uint64_t seq, cancellation_token ct = {}) {
+		return {this, seq, ct};
+	}
+
+private:
+	Allocator allocator_;
+
+	// Serializes updates against waiters; current() does not take it.
+	// Snapshots are allocated and freed outside of the lock.
+	platform::mutex mutex_;
+	// Pointer to the current box, packed with the external count (see above).
+	std::atomic<uintptr_t> current_;
+
+	// Operations that wait for the next update.
+	node_list waiters_;
+};
+
+} // namespace async
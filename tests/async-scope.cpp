@@ -0,0 +1,105 @@
+#include <array>
+
+#include <async/async-scope.hpp>
+#include <async/oneshot-event.hpp>
+#include <async/result.hpp>
+#include <gtest/gtest.h>
+
+TEST(AsyncScope, JoinEmpty) {
+	async::async_scope<> scope;
+	async::run(scope.join());
+}
+
+TEST(AsyncScope, SpawnAndJoin) {
+	async::async_scope<> scope;
+	async::oneshot_event ev;
+	int done = 0;
+
+	for(int i = 0; i < 3; ++i) {
+		scope.spawn([] (async::oneshot_event &ev, int &done) -> async::result<void> {
+			co_await ev.wait();
+			++done;
+		}(ev, done));
+	}
+	ASSERT_EQ(done, 0);
+
+	bool joined = false;
+	async::detach(scope.join(), [&] {
+		joined = true;
+	});
+	ASSERT_FALSE(joined);
+
+	ev.raise();
+	ASSERT_EQ(done, 3);
+	ASSERT_TRUE(joined);
+}
+
+namespace {
+
+// Counts the allocations of control blocks and chunks.
+struct counting_allocator {
+	void *allocate(size_t size) {
+		++*count;
+		return frg::stl_allocator{}.allocate(size);
+	}
+
+	void deallocate(void *p, size_t size) {
+		frg::stl_allocator{}.deallocate(p, size);
+	}
+
+	void free(void *p) {
+		frg::stl_allocator{}.free(p);
+	}
+
+	int *count;
+};
+
+} // anonymous namespace
+
+TEST(AsyncScope, RecycleSlots) {
+	int allocations = 0;
+	async::async_scope<counting_allocator, 256, 2> scope{counting_allocator{&allocations}};
+
+	for(int i = 0; i < 16; ++i) {
+		int v = 0;
+		scope.spawn([] (int &v) -> async::result<int> {
+			v = 42;
+			co_return v;
+		}(v));
+		ASSERT_EQ(v, 42);
+	}
+	// Each operation completes before the next one is spawned, hence all operations
+	// reuse the same slot of the first chunk.
+	ASSERT_EQ(allocations, 1);
+	async::run(scope.join());
+}
+
+TEST(AsyncScope, OversizedControlBlock) {
+	async::async_scope<frg::stl_allocator, 16> scope;
+	async::oneshot_event ev;
+	bool done = false;
+
+	scope.spawn([] (async::oneshot_event &ev, bool &done) -> async::result<void> {
+		co_await ev.wait();
+		done = true;
+	}(ev, done));
+
+	ev.raise();
+	ASSERT_TRUE(done);
+	async::run(scope.join());
+}
+
+TEST(AsyncScope, JoinCancel) {
+	async::async_scope<> scope;
+	async::oneshot_event ev;
+	async::cancellation_event ce;
+
+	scope.spawn(ev.wait());
+
+	ce.cancel();
+	auto success = async::run(scope.join(ce));
+	ASSERT_FALSE(success);
+
+	ev.raise();
+	async::run(scope.join());
+}
@@ -0,0 +1,74 @@
+#include <string>
+#include <vector>
+
+#include <async/broadcast-channel.hpp>
+#include <async/result.hpp>
+#include <gtest/gtest.h>
+
+TEST(BroadcastChannel, AllSubscribers) {
+	async::broadcast_channel<std::string, 4> chan;
+	auto early = chan.subscribe();
+	chan.publish("a");
+	auto late = chan.subscribe();
+	chan.publish("b");
+
+	ASSERT_EQ(async::run(chan.async_receive(early)).value(), "a");
+	ASSERT_EQ(async::run(chan.async_receive(early)).value(), "b");
+	ASSERT_FALSE(chan.try_receive(early));
+
+	// Subscribers only see messages that were published after subscribing.
+	ASSERT_EQ(async::run(chan.async_receive(late)).value(), "b");
+	ASSERT_FALSE(chan.try_receive(late));
+}
+
+TEST(BroadcastChannel, Lagged) {
+	async::broadcast_channel<int, 4> chan;
+	auto fast = chan.subscribe();
+	auto slow = chan.subscribe();
+
+	for (int i = 0; i < 6; i++) {
+		chan.publish(i);
+		ASSERT_EQ(chan.try_receive(fast)->value(), i);
+	}
+
+	auto r = async::run(chan.async_receive(slow));
+	ASSERT_FALSE(r);
+	ASSERT_EQ(r.error(), async::broadcast_error::lagged);
+	// Afterwards, the subscriber continues at the oldest message that is still available.
+	for (int i = 2; i < 6; i++)
+		ASSERT_EQ(chan.try_receive(slow)->value(), i);
+	ASSERT_FALSE(chan.try_receive(slow));
+}
+
+TEST(BroadcastChannel, Waiters) {
+	async::broadcast_channel<int, 4> chan;
+	auto s1 = chan.subscribe();
+	auto s2 = chan.subscribe();
+	auto s3 = chan.subscribe();
+	async::cancellation_event ce;
+	std::vector<int> got;
+
+	auto consumer = [] (async::broadcast_channel<int, 4> &chan,
+			async::broadcast_channel<int, 4>::subscriber &s, async::cancellation_token ct,
+			std::vector<int> &got) -> async::detached {
+		auto r = co_await chan.async_receive(s, ct);
+		if (r)
+			got.push_back(r.value());
+		else
+			got.push_back(r.error() == async::broadcast_error::cancelled ? -1 : -2);
+	};
+
+	consumer(chan, s1, {}, got);
+	consumer(chan, s2, {}, got);
+	consumer(chan, s3, ce, got);
+	ASSERT_TRUE(got.empty());
+	ce.cancel();
+	ASSERT_EQ(got, (std::vector<int>{-1}));
+
+	// A single publish wakes all waiting subscribers.
+	chan.publish(42);
+	ASSERT_EQ(got, (std::vector<int>{-1, 42, 42}));
+
+	// The cancelled subscriber did not lose its position.
+	ASSERT_EQ(chan.try_receive(s3)->value(), 42);
+}
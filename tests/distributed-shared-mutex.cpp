@@ -0,0 +1,102 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <async/distributed-shared-mutex.hpp>
+#include <async/result.hpp>
+#include <gtest/gtest.h>
+
+#include "flag-receiver.hpp"
+
+TEST(DistributedSharedMutex, TryLock) {
+	async::distributed_shared_mutex<4> m;
+
+	ASSERT_TRUE(m.try_lock_shared());
+	ASSERT_TRUE(m.try_lock_shared());
+	ASSERT_FALSE(m.try_lock());
+	m.unlock_shared();
+	ASSERT_FALSE(m.try_lock());
+	m.unlock_shared();
+
+	ASSERT_TRUE(m.try_lock());
+	ASSERT_FALSE(m.try_lock_shared());
+	ASSERT_FALSE(m.try_lock());
+	m.unlock();
+	ASSERT_TRUE(m.try_lock_shared());
+	m.unlock_shared();
+}
+
+TEST(DistributedSharedMutex, WriterDrainsReaders) {
+	async::distributed_shared_mutex<4> m;
+	std::vector<int> order;
+
+	auto lock = [] (async::distributed_shared_mutex<4> &m, int id, std::vector<int> &order)
+			-> async::detached {
+		co_await m.async_lock();
+		order.push_back(id);
+	};
+	auto lock_shared = [] (async::distributed_shared_mutex<4> &m, int id,
+			std::vector<int> &order) -> async::detached {
+		co_await m.async_lock_shared();
+		order.push_back(id);
+	};
+
+	ASSERT_TRUE(m.try_lock_shared());
+	lock(m, 1, order);
+	ASSERT_TRUE(order.empty());
+
+	// Readers cannot enter while the writer waits.
+	lock_shared(m, 2, order);
+	lock_shared(m, 3, order);
+	lock(m, 4, order);
+	ASSERT_TRUE(order.empty());
+
+	m.unlock_shared();
+	ASSERT_EQ(order, (std::vector<int>{1}));
+
+	// All waiting readers are admitted, then the next writer waits for them.
+	m.unlock();
+	ASSERT_EQ(order, (std::vector<int>{1, 2, 3}));
+	m.unlock_shared();
+	ASSERT_EQ(order, (std::vector<int>{1, 2, 3}));
+	m.unlock_shared();
+	ASSERT_EQ(order, (std::vector<int>{1, 2, 3, 4}));
+	m.unlock();
+
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(DistributedSharedMutex, Threads) {
+	async::distributed_shared_mutex<4> m;
+	std::atomic<int> readers{0};
+	int value = 0;
+	std::atomic<bool> violation{false};
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&, t] {
+			std::atomic<bool> flag;
+			for (int i = 0; i < 2000; i++) {
+				if (!t || !(i % 16)) {
+					wait_blocking(m.async_lock(), flag);
+					if (readers.load(std::memory_order_relaxed))
+						violation = true;
+					value++;
+					m.unlock();
+				} else {
+					wait_blocking(m.async_lock_shared(), flag);
+					readers.fetch_add(1, std::memory_order_relaxed);
+					[[maybe_unused]] volatile int v = value;
+					readers.fetch_sub(1, std::memory_order_relaxed);
+					m.unlock_shared();
+				}
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	EXPECT_FALSE(violation);
+	EXPECT_EQ(value, 2000 + 3 * 2000 / 16);
+}
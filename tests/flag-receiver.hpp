@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <utility>
+
+#include <async/basic.hpp>
+
+// Receiver for operations that complete with void. Since there is no IO service to wait on,
+// threads block on the flag until the operation completes.
+struct flag_receiver {
+	void set_value() {
+		auto f = flag; // The operation may be gone after the store.
+		f->store(true, std::memory_order_release);
+		f->notify_one();
+	}
+
+	std::atomic<bool> *flag;
+};
+
+// Starts an operation for sender and blocks the calling thread until it completes.
+template<typename S>
+void wait_blocking(S sender, std::atomic<bool> &flag) {
+	flag.store(false, std::memory_order_relaxed);
+	auto op = async::execution::connect(std::move(sender), flag_receiver{&flag});
+	async::execution::start(op);
+	flag.wait(false, std::memory_order_acquire);
+}
+
+// Runs the items of a run_queue on a separate thread until it is destructed.
+struct queue_runner {
+	queue_runner(async::run_queue &rq)
+	: thread_{[this, &rq] {
+		while (!stop_.load(std::memory_order_acquire)) {
+			rq.run_token().run_iteration();
+			std::this_thread::yield();
+		}
+	}} { }
+
+	~queue_runner() {
+		stop_.store(true, std::memory_order_release);
+		thread_.join();
+	}
+
+private:
+	std::atomic<bool> stop_{false};
+	std::thread thread_;
+};
@@ -1,5 +1,6 @@
 #include <async/generator.hpp>
 #include <async/basic.hpp>
+#include <async/queue.hpp>
 #include <async/result.hpp>
 #include <gtest/gtest.h>
 #include <memory>
@@ -22,6 +23,45 @@ async::generator<std::unique_ptr<int>> generate_unique_ptrs() {
 	co_yield std::make_unique<int>(3);
 }
 
+async::generator<int> generate_from_queue(async::queue<int, frg::stl_allocator> &q) {
+	while (true) {
+		auto v = co_await q.async_get();
+		if (*v < 0)
+			co_return;
+		co_yield *v * 10;
+	}
+}
+
+async::generator<int> generate_awaiting_result() {
+	co_yield co_await []() -> async::result<int> {
+		co_return 1;
+	}();
+	co_yield 2;
+}
+
+async::generator<int> generate_counted(int &produced, int n) {
+	for (int i = 0; i < n; i++) {
+		produced++;
+		co_yield i;
+	}
+}
+
+struct optional_receiver {
+	void set_value(std::optional<int> v) {
+		*out = std::move(v);
+	}
+
+	std::optional<int> *out;
+};
+
+template <size_t K>
+std::optional<int> start_next(async::prefetching_generator<int, K> &p, std::optional<int> &out) {
+	out.reset();
+	auto op = async::execution::connect(p.next(), optional_receiver{&out});
+	async::execution::start(op);
+	return out;
+}
+
 } // anonymous namespace
 
 TEST(Generator, YieldNothing) {
@@ -74,3 +114,136 @@ TEST(Generator, YieldMoveOnly) {
 		EXPECT_FALSE(v4.has_value());
 	}());
 }
+
+TEST(Generator, NextBatch) {
+	async::run([]() -> async::result<void> {
+		auto gen = generate_ints();
+		int buffer[2] = {};
+
+		auto n1 = co_await gen.next_batch(buffer);
+		EXPECT_EQ(n1, 2);
+		EXPECT_EQ(buffer[0], 1);
+		EXPECT_EQ(buffer[1], 2);
+
+		auto n2 = co_await gen.next_batch(buffer);
+		EXPECT_EQ(n2, 1);
+		EXPECT_EQ(buffer[0], 3);
+
+		auto n3 = co_await gen.next_batch(buffer);
+		EXPECT_EQ(n3, 0);
+	}());
+}
+
+TEST(Generator, NextBatchMixed) {
+	async::run([]() -> async::result<void> {
+		auto gen = generate_unique_ptrs();
+		std::unique_ptr<int> buffer[4];
+
+		auto v1 = co_await gen.next();
+		EXPECT_TRUE(v1.has_value());
+		EXPECT_EQ(**v1, 1);
+
+		auto n = co_await gen.next_batch(buffer);
+		EXPECT_EQ(n, 2);
+		EXPECT_EQ(*buffer[0], 2);
+		EXPECT_EQ(*buffer[1], 3);
+
+		auto v2 = co_await gen.next();
+		EXPECT_FALSE(v2.has_value());
+	}());
+}
+
+TEST(Generator, AwaitInBody) {
+	async::queue<int, frg::stl_allocator> q;
+	int values[3] = {};
+	int n = 0;
+	bool done = false;
+
+	auto consumer = [] (async::generator<int> gen, int *values, int &n, bool &done)
+			-> async::detached {
+		while (true) {
+			auto v = co_await gen.next();
+			if (!v)
+				break;
+			values[n++] = *v;
+		}
+		done = true;
+	};
+
+	consumer(generate_from_queue(q), values, n, done);
+	ASSERT_EQ(n, 0);
+
+	q.put(1);
+	ASSERT_EQ(n, 1);
+	ASSERT_EQ(values[0], 10);
+
+	q.put(2);
+	q.put(3);
+	ASSERT_EQ(n, 3);
+	ASSERT_EQ(values[1], 20);
+	ASSERT_EQ(values[2], 30);
+	ASSERT_FALSE(done);
+
+	q.put(-1);
+	ASSERT_TRUE(done);
+}
+
+TEST(Generator, AwaitSenderInBody) {
+	async::run([]() -> async::result<void> {
+		auto gen = generate_awaiting_result();
+
+		auto v1 = co_await gen.next();
+		EXPECT_TRUE(v1.has_value());
+		EXPECT_EQ(*v1, 1);
+
+		auto v2 = co_await gen.next();
+		EXPECT_TRUE(v2.has_value());
+		EXPECT_EQ(*v2, 2);
+
+		auto v3 = co_await gen.next();
+		EXPECT_FALSE(v3.has_value());
+	}());
+}
+
+TEST(Generator, Prefetch) {
+	int produced = 0;
+	auto p = async::prefetch<2>(generate_counted(produced, 5));
+	std::optional<int> out;
+	ASSERT_EQ(produced, 0);
+
+	// The first item goes to the consumer, two more are read ahead.
+	ASSERT_EQ(start_next(p, out), 0);
+	ASSERT_EQ(produced, 3);
+
+	ASSERT_EQ(start_next(p, out), 1);
+	ASSERT_EQ(produced, 4);
+	ASSERT_EQ(start_next(p, out), 2);
+	ASSERT_EQ(produced, 5);
+	ASSERT_EQ(start_next(p, out), 3);
+	ASSERT_EQ(start_next(p, out), 4);
+	ASSERT_EQ(start_next(p, out), std::nullopt);
+	ASSERT_EQ(start_next(p, out), std::nullopt);
+}
+
+TEST(Generator, PrefetchAsync) {
+	async::queue<int, frg::stl_allocator> q;
+	auto p = async::prefetch<2>(generate_from_queue(q));
+	std::optional<int> out;
+
+	auto op = async::execution::connect(p.next(), optional_receiver{&out});
+	async::execution::start(op);
+	ASSERT_FALSE(out);
+	q.put(1);
+	ASSERT_EQ(out, 10);
+
+	// The generator keeps producing while nobody is waiting until the ring is full.
+	q.put(2);
+	q.put(3);
+	q.put(4);
+	ASSERT_EQ(start_next(p, out), 20);
+	ASSERT_EQ(start_next(p, out), 30);
+	ASSERT_EQ(start_next(p, out), 40);
+
+	q.put(-1);
+	ASSERT_EQ(start_next(p, out), std::nullopt);
+}
@@ -0,0 +1,77 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <async/keyed-mutex.hpp>
+#include <async/result.hpp>
+#include <gtest/gtest.h>
+
+#include "flag-receiver.hpp"
+
+TEST(KeyedMutex, TryLock) {
+	// A single stripe forces all keys to collide.
+	async::keyed_mutex<std::string, std::hash<std::string>, 1> m;
+	decltype(m)::holder h1, h2, h3;
+
+	ASSERT_TRUE(m.try_lock(h1, "a"));
+	ASSERT_TRUE(m.try_lock(h2, "b"));
+	ASSERT_FALSE(m.try_lock(h3, "a"));
+	m.unlock(h1);
+	ASSERT_TRUE(m.try_lock(h3, "a"));
+	m.unlock(h2);
+	m.unlock(h3);
+}
+
+TEST(KeyedMutex, Handoff) {
+	async::keyed_mutex<int, std::hash<int>, 1> m;
+	decltype(m)::holder h1, h2, h3, h4;
+	std::vector<int> order;
+
+	auto coro = [] (async::keyed_mutex<int, std::hash<int>, 1> &m,
+			async::keyed_mutex<int, std::hash<int>, 1>::holder &h,
+			int key, int id, std::vector<int> &order) -> async::detached {
+		co_await m.async_lock(h, key);
+		order.push_back(id);
+	};
+
+	coro(m, h1, 1, 1, order);
+	coro(m, h2, 1, 2, order);
+	coro(m, h3, 2, 3, order);
+	coro(m, h4, 1, 4, order);
+	// Different keys do not block each other, even within the same stripe.
+	ASSERT_EQ(order, (std::vector<int>{1, 3}));
+
+	m.unlock(h1);
+	ASSERT_EQ(order, (std::vector<int>{1, 3, 2}));
+	m.unlock(h3);
+	m.unlock(h2);
+	ASSERT_EQ(order, (std::vector<int>{1, 3, 2, 4}));
+	m.unlock(h4);
+
+	async::keyed_mutex<int, std::hash<int>, 1>::holder h5;
+	ASSERT_TRUE(m.try_lock(h5, 1));
+	m.unlock(h5);
+}
+
+TEST(KeyedMutex, Threads) {
+	async::keyed_mutex<int, std::hash<int>, 4> m;
+	constexpr int num_keys = 3;
+	int counters[num_keys] = {};
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 6; t++) {
+		threads.emplace_back([&, t] {
+			decltype(m)::holder h;
+			std::atomic<bool> locked;
+			for (int i = 0; i < 5000; i++) {
+				int key = (t + i) % num_keys;
+				wait_blocking(m.async_lock(h, key), locked);
+				counters[key]++;
+				m.unlock(h);
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	ASSERT_EQ(counters[0] + counters[1] + counters[2], 6 * 5000);
+}
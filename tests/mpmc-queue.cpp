@@ -0,0 +1,120 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <async/mpmc-queue.hpp>
+#include <async/result.hpp>
+#include <gtest/gtest.h>
+
+namespace {
+
+struct get_receiver {
+	void set_value(frg::optional<int> v) {
+		auto f = flag; // The operation may be gone after the store.
+		*out = v ? *v : -1;
+		f->store(true, std::memory_order_release);
+		f->notify_one();
+	}
+
+	std::atomic<bool> *flag;
+	int *out;
+};
+
+} // anonymous namespace
+
+TEST(MpmcQueue, TryPut) {
+	async::mpmc_queue<int, 4> q;
+
+	for (int i = 0; i < 4; i++)
+		ASSERT_TRUE(q.try_put(i));
+	ASSERT_FALSE(q.try_put(4));
+
+	ASSERT_EQ(*q.maybe_get(), 0);
+	ASSERT_TRUE(q.try_put(4));
+	for (int i = 1; i < 5; i++)
+		ASSERT_EQ(*q.maybe_get(), i);
+	ASSERT_FALSE(q.maybe_get());
+}
+
+TEST(MpmcQueue, AsyncGet) {
+	async::mpmc_queue<int, 4> q;
+	std::vector<int> got;
+
+	auto coro = [] (async::mpmc_queue<int, 4> &q, std::vector<int> &got) -> async::detached {
+		got.push_back(*(co_await q.async_get()));
+	};
+
+	coro(q, got);
+	coro(q, got);
+	ASSERT_TRUE(got.empty());
+
+	ASSERT_TRUE(q.try_put(1));
+	ASSERT_EQ(got, (std::vector<int>{1}));
+	ASSERT_TRUE(q.try_put(2));
+	ASSERT_TRUE(q.try_put(3));
+	ASSERT_EQ(got, (std::vector<int>{1, 2}));
+
+	// Items that are already in the queue are returned immediately.
+	coro(q, got);
+	ASSERT_EQ(got, (std::vector<int>{1, 2, 3}));
+}
+
+TEST(MpmcQueue, Cancel) {
+	async::mpmc_queue<int, 4> q;
+	async::cancellation_event ce;
+	frg::optional<int> result{0};
+	bool done = false;
+
+	auto coro = [] (async::mpmc_queue<int, 4> &q, async::cancellation_token ct,
+			frg::optional<int> &result, bool &done) -> async::detached {
+		result = co_await q.async_get(ct);
+		done = true;
+	};
+
+	coro(q, ce, result, done);
+	ASSERT_FALSE(done);
+	ce.cancel();
+	ASSERT_TRUE(done);
+	ASSERT_FALSE(result);
+
+	// The cancelled operation does not take any items.
+	ASSERT_TRUE(q.try_put(1));
+	ASSERT_EQ(*q.maybe_get(), 1);
+}
+
+TEST(MpmcQueue, Threads) {
+	async::mpmc_queue<int, 16> q;
+	constexpr int num_producers = 3;
+	constexpr int num_consumers = 3;
+	constexpr int items_per_producer = 20000;
+	std::atomic<long> sum{0};
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_producers; t++) {
+		threads.emplace_back([&] {
+			for (int i = 1; i <= items_per_producer; i++) {
+				while (!q.try_put(i))
+					std::this_thread::yield();
+			}
+		});
+	}
+	for (int t = 0; t < num_consumers; t++) {
+		threads.emplace_back([&] {
+			std::atomic<bool> done;
+			int value;
+			for (int i = 0; i < num_producers * items_per_producer / num_consumers; i++) {
+				done.store(false, std::memory_order_relaxed);
+				auto op = async::execution::connect(q.async_get(),
+						get_receiver{&done, &value});
+				async::execution::start(op);
+				done.wait(false, std::memory_order_acquire);
+				sum.fetch_add(value, std::memory_order_relaxed);
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+
+	ASSERT_EQ(sum.load(), long{num_producers} * items_per_producer * (items_per_producer + 1) / 2);
+	ASSERT_FALSE(q.maybe_get());
+}
@@ -1,9 +1,14 @@
+#include <atomic>
 #include <new>
+#include <thread>
+#include <vector>
 
 #include <async/mutex.hpp>
 #include <async/result.hpp>
 #include <gtest/gtest.h>
 
+#include "flag-receiver.hpp"
+
 TEST(Mutex, TryLock) {
 	async::mutex m;
 
@@ -13,3 +18,562 @@ TEST(Mutex, TryLock) {
 	ASSERT_TRUE(m.try_lock());
 	m.unlock();
 }
+
+namespace {
+
+// Acquires the mutex from multiple threads. Since there is no IO service to wait on,
+// threads block on an atomic until their lock operation completes.
+template<typename Mutex>
+void hammer(Mutex &m, int num_threads, int iterations) {
+	int counter = 0;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.emplace_back([&] {
+			// Outlives all notifications.
+			std::atomic<bool> locked;
+			for (int i = 0; i < iterations; i++) {
+				wait_blocking(m.async_lock(), locked);
+				counter++;
+				m.unlock();
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	EXPECT_EQ(counter, num_threads * iterations);
+}
+
+struct result_receiver {
+	void set_value(bool r) {
+		auto f = flag; // The operation may be gone after the store.
+		*result = r;
+		f->store(true, std::memory_order_release);
+		f->notify_one();
+	}
+
+	bool *result;
+	std::atomic<bool> *flag;
+};
+
+// Like hammer() but every third lock operation is cancelled immediately.
+template<typename Mutex>
+void hammer_cancel(Mutex &m, int num_threads, int iterations) {
+	int counter = 0;
+	std::atomic<int> acquired{0};
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.emplace_back([&] {
+			std::atomic<bool> done;
+			for (int i = 0; i < iterations; i++) {
+				async::cancellation_event ce;
+				bool result = false;
+				done.store(false, std::memory_order_relaxed);
+				auto op = async::execution::connect(m.async_lock(ce), result_receiver{&result, &done});
+				async::execution::start(op);
+				if (!(i % 3))
+					ce.cancel();
+				done.wait(false, std::memory_order_acquire);
+				if (!result)
+					continue;
+				counter++;
+				acquired.fetch_add(1, std::memory_order_relaxed);
+				m.unlock();
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	EXPECT_EQ(counter, acquired.load());
+	EXPECT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+} // anonymous namespace
+
+TEST(Mutex, Contended) {
+	async::mutex m;
+	hammer(m, 8, 5000);
+}
+
+TEST(Mutex, AdaptiveSpin) {
+	async::mutex m{{.adaptive_spin = true}};
+
+	// Spinning on a mutex that is held by the same thread must still fall back to waiting.
+	bool done = false;
+	ASSERT_TRUE(m.try_lock());
+	auto coro = [] (async::mutex &m, bool &done) -> async::detached {
+		co_await m.async_lock();
+		done = true;
+		m.unlock();
+	};
+	coro(m, done);
+	ASSERT_FALSE(done);
+	m.unlock();
+	ASSERT_TRUE(done);
+
+	hammer(m, 4, 10000);
+}
+
+TEST(Mutex, Barging) {
+	async::run_queue rq;
+	async::mutex m{{.barging = true, .wakeup_queue = &rq}};
+	int order[2] = {};
+	int n = 0;
+
+	auto coro = [] (async::mutex &m, int id, int *order, int &n) -> async::detached {
+		co_await m.async_lock();
+		order[n++] = id;
+		m.unlock();
+	};
+
+	ASSERT_TRUE(m.try_lock());
+	coro(m, 1, order, n);
+	coro(m, 2, order, n);
+	ASSERT_EQ(n, 0);
+
+	// Waiters retry in FIFO order, one per iteration.
+	m.unlock();
+	rq.run_token().run_iteration();
+	ASSERT_EQ(n, 1);
+	rq.run_token().run_iteration();
+	ASSERT_EQ(n, 2);
+	ASSERT_EQ(order[0], 1);
+	ASSERT_EQ(order[1], 2);
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+
+	queue_runner runner{rq};
+	hammer(m, 8, 5000);
+}
+
+TEST(Mutex, DeferredWakeup) {
+	async::run_queue rq;
+	async::mutex m{{.wakeup_queue = &rq}};
+	int n = 0;
+
+	auto coro = [] (async::mutex &m, int &n) -> async::detached {
+		co_await m.async_lock();
+		n++;
+		m.unlock();
+	};
+
+	ASSERT_TRUE(m.try_lock());
+	coro(m, n);
+	coro(m, n);
+	m.unlock();
+	// The first waiter owns the mutex but it was not resumed yet.
+	ASSERT_EQ(n, 0);
+	ASSERT_FALSE(m.try_lock());
+
+	// Each waiter only completes in its own iteration, i.e., waiters do not recurse.
+	rq.run_token().run_iteration();
+	ASSERT_EQ(n, 1);
+	rq.run_token().run_iteration();
+	ASSERT_EQ(n, 2);
+	ASSERT_TRUE(rq.run_token().is_drained());
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(Mutex, DeferredWakeupBarging) {
+	async::run_queue rq;
+	async::mutex m{{.barging = true, .wakeup_queue = &rq}};
+	bool done = false;
+
+	auto coro = [] (async::mutex &m, bool &done) -> async::detached {
+		co_await m.async_lock();
+		done = true;
+		m.unlock();
+	};
+
+	ASSERT_TRUE(m.try_lock());
+	coro(m, done);
+	m.unlock();
+
+	// The mutex is free until the waiter runs, so we can take it.
+	ASSERT_TRUE(m.try_lock());
+	rq.run_token().run_iteration();
+	ASSERT_FALSE(done);
+
+	// The waiter was enqueued again.
+	m.unlock();
+	rq.run_token().run_iteration();
+	ASSERT_TRUE(done);
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(Mutex, BargingKeepsPlace) {
+	async::run_queue rq;
+	async::mutex m{{.barging = true, .wakeup_queue = &rq}};
+	std::vector<int> order;
+
+	auto coro = [] (async::mutex &m, int id, std::vector<int> &order) -> async::detached {
+		co_await m.async_lock();
+		order.push_back(id);
+		m.unlock();
+	};
+
+	ASSERT_TRUE(m.try_lock());
+	coro(m, 1, order);
+	coro(m, 2, order);
+	m.unlock();
+
+	// The first waiter loses the race against try_lock() but it stays ahead of the second one.
+	ASSERT_TRUE(m.try_lock());
+	rq.run_token().run_iteration();
+	m.unlock();
+	while (!rq.run_token().is_drained())
+		rq.run_token().run_iteration();
+	ASSERT_EQ(order, (std::vector<int>{1, 2}));
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(Mutex, Cancel) {
+	async::mutex m;
+	async::cancellation_event ce;
+	std::vector<int> order;
+
+	auto coro = [] (async::mutex &m, int id, async::cancellation_token ct,
+			std::vector<int> &order) -> async::detached {
+		if (!co_await m.async_lock(ct)) {
+			order.push_back(-id);
+			co_return;
+		}
+		order.push_back(id);
+		m.unlock();
+	};
+
+	ASSERT_TRUE(m.try_lock());
+	coro(m, 1, {}, order);
+	coro(m, 2, ce, order);
+	coro(m, 3, {}, order);
+
+	// Cancellation does not need to wait for the owner.
+	ce.cancel();
+	ASSERT_EQ(order, (std::vector<int>{-2}));
+	m.unlock();
+	ASSERT_EQ(order, (std::vector<int>{-2, 1, 3}));
+
+	// If the only waiter is cancelled, unlock() can take the fast path again.
+	async::cancellation_event ce2;
+	ASSERT_TRUE(m.try_lock());
+	coro(m, 4, ce2, order);
+	ce2.cancel();
+	m.unlock();
+	ASSERT_EQ(order, (std::vector<int>{-2, 1, 3, -4}));
+
+	// Already cancelled tokens only fail if the mutex is not available.
+	coro(m, 5, ce, order);
+	ASSERT_EQ(order, (std::vector<int>{-2, 1, 3, -4, 5}));
+	ASSERT_TRUE(m.try_lock());
+	coro(m, 6, ce, order);
+	ASSERT_EQ(order, (std::vector<int>{-2, 1, 3, -4, 5, -6}));
+	m.unlock();
+
+	hammer_cancel(m, 8, 3000);
+}
+
+TEST(Mutex, CancelBarging) {
+	async::run_queue rq;
+	async::mutex m{{.barging = true, .wakeup_queue = &rq}};
+	queue_runner runner{rq};
+	hammer_cancel(m, 8, 3000);
+}
+
+TEST(Mutex, CancelWhileWaking) {
+	async::run_queue rq;
+	async::mutex m{{.barging = true, .wakeup_queue = &rq}};
+	async::cancellation_event ce;
+	int result = 0;
+
+	auto coro = [] (async::mutex &m, async::cancellation_token ct,
+			int &result) -> async::detached {
+		bool locked = co_await m.async_lock(ct);
+		result = locked ? 1 : -1;
+		if (locked)
+			m.unlock();
+	};
+
+	ASSERT_TRUE(m.try_lock());
+	coro(m, ce, result);
+	m.unlock();
+
+	// The waiter was popped but it did not retry yet. Another thread barges in and
+	// the waiter is cancelled in the meantime.
+	ASSERT_TRUE(m.try_lock());
+	ce.cancel();
+	ASSERT_EQ(result, 0);
+	rq.run_token().run_iteration();
+	ASSERT_EQ(result, -1);
+	m.unlock();
+	ASSERT_TRUE(rq.run_token().is_drained());
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(SharedMutex, DeferredWakeup) {
+	async::run_queue rq;
+	async::shared_mutex m{{.wakeup_queue = &rq}};
+	int n = 0;
+
+	auto coro = [] (async::shared_mutex &m, int &n) -> async::detached {
+		co_await m.async_lock_shared();
+		n++;
+		m.unlock_shared();
+	};
+
+	ASSERT_TRUE(m.try_lock());
+	coro(m, n);
+	coro(m, n);
+	m.unlock();
+	ASSERT_EQ(n, 0);
+
+	// Both readers are granted the lock at the same time.
+	rq.run_token().run_iteration();
+	ASSERT_EQ(n, 2);
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(SharedMutex, PhaseFair) {
+	async::shared_mutex m{{.phase_fair = true}};
+	std::vector<int> order;
+
+	auto lock = [] (async::shared_mutex &m, int id, std::vector<int> &order)
+			-> async::detached {
+		co_await m.async_lock();
+		order.push_back(id);
+	};
+	auto lock_shared = [] (async::shared_mutex &m, int id, std::vector<int> &order)
+			-> async::detached {
+		co_await m.async_lock_shared();
+		order.push_back(id);
+	};
+
+	ASSERT_TRUE(m.try_lock());
+	lock(m, 1, order);
+	lock_shared(m, 2, order);
+	lock_shared(m, 3, order);
+	lock(m, 4, order);
+	ASSERT_TRUE(order.empty());
+
+	// All waiting readers overtake the waiting writers.
+	m.unlock();
+	ASSERT_EQ(order, (std::vector<int>{2, 3}));
+
+	// New readers do not join the read phase while writers are waiting.
+	lock_shared(m, 5, order);
+	ASSERT_EQ(order.size(), 2);
+
+	m.unlock_shared();
+	m.unlock_shared();
+	ASSERT_EQ(order, (std::vector<int>{2, 3, 1}));
+
+	// Writers alternate with read phases.
+	m.unlock();
+	ASSERT_EQ(order, (std::vector<int>{2, 3, 1, 5}));
+	m.unlock_shared();
+	ASSERT_EQ(order, (std::vector<int>{2, 3, 1, 5, 4}));
+	m.unlock();
+
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(SharedMutex, Upgrade) {
+	async::shared_mutex m;
+	std::vector<int> order;
+
+	auto lock_shared = [] (async::shared_mutex &m, int id, std::vector<int> &order)
+			-> async::detached {
+		co_await m.async_lock_shared();
+		order.push_back(id);
+	};
+	auto lock_upgradeable = [] (async::shared_mutex &m, int id, std::vector<int> &order)
+			-> async::detached {
+		co_await m.async_lock_upgradeable();
+		order.push_back(id);
+		co_await m.async_upgrade();
+		order.push_back(-id);
+	};
+
+	// Upgradeable locks coexist with shared locks but not with each other.
+	lock_shared(m, 1, order);
+	lock_upgradeable(m, 2, order);
+	lock_upgradeable(m, 3, order);
+	ASSERT_EQ(order, (std::vector<int>{1, 2}));
+
+	// While 2 waits for the reader to leave, new readers queue up behind it.
+	lock_shared(m, 4, order);
+	ASSERT_EQ(order, (std::vector<int>{1, 2}));
+
+	m.unlock_shared();
+	ASSERT_EQ(order, (std::vector<int>{1, 2, -2}));
+	ASSERT_FALSE(m.try_lock_shared());
+
+	// Downgrading admits the waiting readers without releasing the lock. 3 was queued
+	// as a reader once 2 requested the upgrade.
+	m.downgrade();
+	ASSERT_EQ(order, (std::vector<int>{1, 2, -2, 3, 4}));
+	// 3 already requested an upgrade; hence, new readers have to wait.
+	ASSERT_FALSE(m.try_lock_shared());
+
+	m.unlock_shared();
+	m.unlock_shared();
+	ASSERT_EQ(order, (std::vector<int>{1, 2, -2, 3, 4, -3}));
+	m.unlock();
+
+	// An upgradeable lock can also be released without upgrading it.
+	async::run(m.async_lock_upgradeable());
+	ASSERT_FALSE(m.try_lock());
+	m.unlock_upgradeable();
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(SharedMutex, Cancel) {
+	async::shared_mutex m;
+	std::vector<int> order;
+
+	auto lock = [] (async::shared_mutex &m, int id, async::cancellation_token ct,
+			std::vector<int> &order) -> async::detached {
+		order.push_back(co_await m.async_lock(ct) ? id : -id);
+	};
+	auto lock_shared = [] (async::shared_mutex &m, int id, async::cancellation_token ct,
+			std::vector<int> &order) -> async::detached {
+		order.push_back(co_await m.async_lock_shared(ct) ? id : -id);
+	};
+	auto lock_upgradeable = [] (async::shared_mutex &m, int id, async::cancellation_token ct,
+			std::vector<int> &order) -> async::detached {
+		order.push_back(co_await m.async_lock_upgradeable(ct) ? id : -id);
+	};
+
+	// Readers that are only blocked by a cancelled writer join the current readers.
+	async::cancellation_event ce1;
+	lock_shared(m, 1, {}, order);
+	lock(m, 2, ce1, order);
+	lock_shared(m, 3, {}, order);
+	ASSERT_EQ(order, (std::vector<int>{1}));
+	ce1.cancel();
+	// 3 is admitted before the cancelled operation completes.
+	ASSERT_EQ(order, (std::vector<int>{1, 3, -2}));
+	ASSERT_TRUE(m.try_lock_shared());
+	m.unlock_shared();
+	m.unlock_shared();
+	m.unlock_shared();
+
+	// Cancelling all waiters of an exclusive owner.
+	async::cancellation_event ce2;
+	ASSERT_TRUE(m.try_lock());
+	lock_shared(m, 4, ce2, order);
+	lock(m, 5, ce2, order);
+	ce2.cancel();
+	ASSERT_EQ(order, (std::vector<int>{1, 3, -2, -4, -5}));
+	m.unlock();
+
+	// A cancelled upgradeable waiter does not block the next one.
+	async::cancellation_event ce3;
+	ASSERT_TRUE(m.try_lock());
+	lock_upgradeable(m, 6, ce3, order);
+	lock_upgradeable(m, 7, {}, order);
+	ce3.cancel();
+	ASSERT_EQ(order, (std::vector<int>{1, 3, -2, -4, -5, -6}));
+	m.unlock();
+	ASSERT_EQ(order, (std::vector<int>{1, 3, -2, -4, -5, -6, 7}));
+	m.unlock_upgradeable();
+
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(ConditionVariable, NotifyOne) {
+	async::mutex m;
+	async::condition_variable cv;
+	bool ready = false;
+	bool done = false;
+
+	auto coro = [] (async::mutex &m, async::condition_variable &cv, bool &ready, bool &done)
+			-> async::detached {
+		co_await m.async_lock();
+		auto success = co_await cv.async_wait(m, [&] { return ready; });
+		EXPECT_TRUE(success);
+		EXPECT_FALSE(m.try_lock());
+		done = true;
+		m.unlock();
+	};
+
+	coro(m, cv, ready, done);
+	ASSERT_FALSE(done);
+
+	// Spurious notification: the predicate is still false.
+	cv.notify_one();
+	ASSERT_FALSE(done);
+
+	ASSERT_TRUE(m.try_lock());
+	ready = true;
+	cv.notify_one();
+	// The waiter is queued on the mutex instead of being resumed.
+	ASSERT_FALSE(done);
+	m.unlock();
+	ASSERT_TRUE(done);
+
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(ConditionVariable, NotifyAll) {
+	async::mutex m;
+	async::condition_variable cv;
+	bool ready = false;
+	int done = 0;
+
+	auto coro = [] (async::mutex &m, async::condition_variable &cv, bool &ready, int &done)
+			-> async::detached {
+		co_await m.async_lock();
+		co_await cv.async_wait(m, [&] { return ready; });
+		++done;
+		m.unlock();
+	};
+
+	coro(m, cv, ready, done);
+	coro(m, cv, ready, done);
+	coro(m, cv, ready, done);
+
+	ready = true;
+	cv.notify_all();
+	ASSERT_EQ(done, 3);
+
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
+
+TEST(ConditionVariable, Cancel) {
+	async::mutex m;
+	async::condition_variable cv;
+	async::cancellation_event ce;
+	bool done = false;
+
+	auto coro = [] (async::mutex &m, async::condition_variable &cv,
+			async::cancellation_token ct, bool &done) -> async::detached {
+		co_await m.async_lock();
+		auto success = co_await cv.async_wait(m, [] { return false; }, ct);
+		EXPECT_FALSE(success);
+		done = true;
+		m.unlock();
+	};
+
+	coro(m, cv, ce, done);
+	ASSERT_FALSE(done);
+
+	// The cancelled waiter has to re-acquire the mutex before it completes.
+	ASSERT_TRUE(m.try_lock());
+	ce.cancel();
+	ASSERT_FALSE(done);
+	m.unlock();
+	ASSERT_TRUE(done);
+
+	ASSERT_TRUE(m.try_lock());
+	m.unlock();
+}
@@ -0,0 +1,134 @@
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <async/persistent-queue.hpp>
+#include <async/result.hpp>
+#include <gtest/gtest.h>
+
+#include <frg/std_compat.hpp>
+
+#include <unistd.h>
+
+namespace {
+
+struct record {
+	int id;
+	double payload;
+};
+
+struct temp_dir {
+	temp_dir() {
+		char path[] = "/tmp/libasync-test-XXXXXX";
+		EXPECT_NE(mkdtemp(path), nullptr);
+		this->path = path;
+	}
+
+	~temp_dir() {
+		// Fails unless all segment files were unlinked.
+		EXPECT_EQ(rmdir(path.c_str()), 0);
+	}
+
+	std::string path;
+};
+
+// Counts the spill segments that are currently mapped.
+int mapped_segments() {
+	std::ifstream maps{"/proc/self/maps"};
+	int n = 0;
+	for (std::string line; std::getline(maps, line);) {
+		if (line.find("libasync-spill-") != std::string::npos)
+			n++;
+	}
+	return n;
+}
+
+} // anonymous namespace
+
+TEST(PersistentQueue, Spill) {
+	temp_dir dir;
+	// 4 KiB segments hold 256 records each.
+	async::persistent_queue<record, frg::stl_allocator> q{dir.path, 100, 4096};
+
+	int next_put = 0;
+	int next_get = 0;
+	for (int round = 0; round < 5; round++) {
+		for (int i = 0; i < 1000; i++) {
+			q.put({next_put, next_put * 0.5});
+			next_put++;
+		}
+		for (int i = 0; i < 700; i++) {
+			auto r = async::run(q.async_get());
+			ASSERT_TRUE(r);
+			ASSERT_EQ(r->id, next_get);
+			ASSERT_EQ(r->payload, next_get * 0.5);
+			next_get++;
+		}
+	}
+#ifdef __linux__
+	// 1500 items are left; all but (at most) 100 of them are spilled.
+	ASSERT_GE(mapped_segments(), 1400 / 256);
+#endif
+
+	while (auto r = q.maybe_get())
+		ASSERT_EQ(r->id, next_get++);
+	ASSERT_EQ(next_get, next_put);
+	ASSERT_TRUE(q.empty());
+#ifdef __linux__
+	// Consumed segments are reclaimed, except for one spare.
+	ASSERT_EQ(mapped_segments(), 1);
+#endif
+
+	// After draining, new items are kept in memory again.
+	q.put({-1, 0});
+#ifdef __linux__
+	ASSERT_EQ(mapped_segments(), 1);
+#endif
+	ASSERT_EQ(q.maybe_get()->id, -1);
+}
+
+TEST(PersistentQueue, ReuseSpare) {
+	temp_dir dir;
+	async::persistent_queue<record, frg::stl_allocator> q{dir.path, 0, 4096};
+
+	// Cycle through many segments; only the spare and the newest segment stay mapped.
+	int next_get = 0;
+	for (int i = 0; i < 10 * 256; i++) {
+		q.put({i, 0});
+		ASSERT_EQ(q.maybe_get()->id, next_get++);
+#ifdef __linux__
+		ASSERT_LE(mapped_segments(), 2);
+#endif
+	}
+	ASSERT_TRUE(q.empty());
+}
+
+TEST(PersistentQueue, Waiters) {
+	temp_dir dir;
+	async::persistent_queue<record, frg::stl_allocator> q{dir.path, 1, 4096};
+	async::cancellation_event ce;
+	int got = 0;
+	bool cancelled = false;
+
+	auto consumer = [] (async::persistent_queue<record, frg::stl_allocator> &q,
+			int &got) -> async::detached {
+		got = (co_await q.async_get())->id;
+	};
+	auto cancelled_consumer = [] (async::persistent_queue<record, frg::stl_allocator> &q,
+			async::cancellation_token ct, bool &cancelled) -> async::detached {
+		cancelled = !(co_await q.async_get(ct));
+	};
+
+	cancelled_consumer(q, ce, cancelled);
+	consumer(q, got);
+	ce.cancel();
+	ASSERT_TRUE(cancelled);
+	q.put({1, 0});
+	ASSERT_EQ(got, 1);
+	q.put({2, 0});
+	q.put({3, 0}); // Spilled.
+	consumer(q, got);
+	ASSERT_EQ(got, 2);
+	consumer(q, got);
+	ASSERT_EQ(got, 3);
+}
@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include <async/priority-queue.hpp>
+#include <async/result.hpp>
+#include <gtest/gtest.h>
+
+#include <frg/std_compat.hpp>
+
+TEST(PriorityQueue, Order) {
+	async::priority_queue<int, frg::stl_allocator> q;
+	std::vector<int> items;
+	std::mt19937 rng{42};
+	for (int i = 0; i < 1000; i++)
+		items.push_back(rng() % 100);
+
+	for (auto v : items)
+		q.put(v);
+	std::sort(items.begin(), items.end(), std::greater<int>{});
+
+	for (auto v : items)
+		ASSERT_EQ(async::run(q.async_get()), v);
+	ASSERT_FALSE(q.maybe_get());
+}
+
+TEST(PriorityQueue, Waiters) {
+	struct request {
+		int priority;
+		int id;
+	};
+	struct by_priority {
+		bool operator() (const request &a, const request &b) const {
+			return a.priority < b.priority;
+		}
+	};
+	using queue_type = async::priority_queue<request, frg::stl_allocator, by_priority>;
+
+	queue_type q;
+	std::vector<int> done;
+
+	auto consumer = [] (queue_type &q, async::cancellation_token ct,
+			std::vector<int> &done) -> async::detached {
+		auto r = co_await q.async_get(ct);
+		done.push_back(r ? r->id : -1);
+	};
+
+	// Waiting consumers receive items directly, in FIFO order.
+	async::cancellation_event ce;
+	consumer(q, {}, done);
+	consumer(q, ce, done);
+	consumer(q, {}, done);
+	q.emplace(0, 1);
+	ce.cancel();
+	q.emplace(0, 2);
+	ASSERT_EQ(done, (std::vector<int>{1, -1, 2}));
+
+	// Urgent requests overtake the backlog.
+	q.emplace(1, 3);
+	q.emplace(1, 4);
+	q.emplace(5, 5);
+	consumer(q, {}, done);
+	ASSERT_EQ(done, (std::vector<int>{1, -1, 2, 5}));
+}
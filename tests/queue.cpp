@@ -1,4 +1,6 @@
+#include <memory>
 #include <new>
+#include <vector>
 
 #include <async/queue.hpp>
 #include <async/result.hpp>
@@ -23,3 +25,112 @@ TEST(Queue, Cancel) {
 	auto v1 = async::run(q.async_get(ce));
 	ASSERT_FALSE(v1);
 }
+
+TEST(Queue, BoundedPut) {
+	async::queue<int, frg::stl_allocator> q{2};
+	async::cancellation_event ce;
+	std::vector<int> done;
+
+	auto producer = [] (async::queue<int, frg::stl_allocator> &q, int v,
+			async::cancellation_token ct, std::vector<int> &done) -> async::detached {
+		auto success = co_await q.async_put(v, ct);
+		done.push_back(success ? v : -v);
+	};
+
+	producer(q, 1, {}, done);
+	producer(q, 2, {}, done);
+	producer(q, 3, {}, done);
+	producer(q, 4, ce, done);
+	ASSERT_EQ(done, (std::vector<int>{1, 2}));
+
+	// Taking an item makes space for the oldest waiting producer.
+	ASSERT_EQ(q.maybe_get(), 1);
+	ASSERT_EQ(done, (std::vector<int>{1, 2, 3}));
+
+	ce.cancel();
+	ASSERT_EQ(done, (std::vector<int>{1, 2, 3, -4}));
+
+	ASSERT_EQ(async::run(q.async_get()), 2);
+	ASSERT_EQ(async::run(q.async_get()), 3);
+	ASSERT_FALSE(q.maybe_get());
+
+	// Waiting consumers receive the item directly.
+	frg::optional<int> v;
+	auto consumer = [] (async::queue<int, frg::stl_allocator> &q,
+			frg::optional<int> &v) -> async::detached {
+		v = co_await q.async_get();
+	};
+	consumer(q, v);
+	producer(q, 5, {}, done);
+	ASSERT_EQ(v, 5);
+	ASSERT_EQ(done, (std::vector<int>{1, 2, 3, -4, 5}));
+}
+
+TEST(Queue, Batch) {
+	async::queue<int, frg::stl_allocator> q;
+	std::vector<int> items{1, 2, 3, 4, 5};
+	q.put_range(items);
+
+	int out[3] = {};
+	ASSERT_EQ(async::run(q.async_get_batch(out)), 3);
+	ASSERT_EQ(std::vector<int>(out, out + 3), (std::vector<int>{1, 2, 3}));
+	ASSERT_EQ(async::run(q.async_get_batch(out)), 2);
+	ASSERT_EQ(std::vector<int>(out, out + 2), (std::vector<int>{4, 5}));
+
+	// Waiting consumers receive items directly, in FIFO order.
+	frg::optional<int> v;
+	size_t n = 0;
+	auto consumer = [] (async::queue<int, frg::stl_allocator> &q,
+			frg::optional<int> &v) -> async::detached {
+		v = co_await q.async_get();
+	};
+	auto batch_consumer = [] (async::queue<int, frg::stl_allocator> &q,
+			std::span<int> out, size_t &n) -> async::detached {
+		n = co_await q.async_get_batch(out);
+	};
+	consumer(q, v);
+	batch_consumer(q, out, n);
+
+	std::vector<int> more{6, 7, 8, 9, 10};
+	q.put_range(more);
+	ASSERT_EQ(v, 6);
+	ASSERT_EQ(n, 3);
+	ASSERT_EQ(std::vector<int>(out, out + 3), (std::vector<int>{7, 8, 9}));
+	ASSERT_EQ(q.maybe_get(), 10);
+
+	// A single put completes a waiting batch consumer immediately.
+	batch_consumer(q, out, n);
+	q.put(11);
+	ASSERT_EQ(n, 1);
+	ASSERT_EQ(out[0], 11);
+
+	async::cancellation_event ce;
+	ce.cancel();
+	ASSERT_EQ(async::run(q.async_get_batch(out, ce)), 0);
+
+	// An empty batch completes immediately and does not take any item.
+	ASSERT_EQ(async::run(q.async_get_batch({})), 0);
+	q.put(12);
+	ASSERT_EQ(async::run(q.async_get_batch({})), 0);
+	ASSERT_EQ(q.maybe_get(), 12);
+}
+
+TEST(Queue, ManyItems) {
+	async::queue<std::unique_ptr<int>, frg::stl_allocator> q;
+	int next_put = 0;
+	int next_get = 0;
+
+	// Grow and shrink the buffer repeatedly such that it spans multiple blocks.
+	for (int round = 0; round < 10; round++) {
+		for (int i = 0; i < 1000; i++)
+			q.put(std::make_unique<int>(next_put++));
+		for (int i = 0; i < 700; i++) {
+			auto v = q.maybe_get();
+			ASSERT_TRUE(v);
+			ASSERT_EQ(**v, next_get++);
+		}
+	}
+
+	// The remaining items are destructed together with the queue.
+	ASSERT_FALSE(q.empty());
+}
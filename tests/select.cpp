@@ -0,0 +1,210 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <async/oneshot-event.hpp>
+#include <async/queue.hpp>
+#include <async/recurring-event.hpp>
+#include <async/result.hpp>
+#include <async/select.hpp>
+#include <gtest/gtest.h>
+
+#include <frg/std_compat.hpp>
+
+using queue_type = async::queue<int, frg::stl_allocator>;
+
+TEST(Select, Queues) {
+	queue_type qa;
+	queue_type qb;
+	async::selector sel{qa, qb};
+	std::vector<int> got;
+
+	auto coro = [] (auto &sel, std::vector<int> &got) -> async::detached {
+		auto i = co_await sel.async_select();
+		got.push_back(*i);
+		if (*i == 0)
+			got.push_back(sel.template take<0>());
+		else
+			got.push_back(sel.template take<1>());
+	};
+
+	coro(sel, got);
+	ASSERT_TRUE(got.empty());
+	qb.put(1);
+	ASSERT_EQ(got, (std::vector<int>{1, 1}));
+
+	// The arm of qa is still linked; it is dropped when an item arrives.
+	qa.put(2);
+	ASSERT_FALSE(qa.empty());
+
+	// Ready sources complete immediately; earlier sources win.
+	qb.put(3);
+	coro(sel, got);
+	ASSERT_EQ(got, (std::vector<int>{1, 1, 0, 2}));
+	coro(sel, got);
+	ASSERT_EQ(got, (std::vector<int>{1, 1, 0, 2, 1, 3}));
+
+	// Arms that are still linked are reused.
+	coro(sel, got);
+	qa.put(4);
+	ASSERT_EQ(got, (std::vector<int>{1, 1, 0, 2, 1, 3, 0, 4}));
+	qb.put(5);
+	ASSERT_EQ(qb.maybe_get(), 5);
+}
+
+TEST(Select, PutRange) {
+	queue_type qa;
+	queue_type qb;
+	async::selector sel{qa, qb};
+	std::vector<int> got;
+
+	auto coro = [] (auto &sel, std::vector<int> &got) -> async::detached {
+		auto i = co_await sel.async_select();
+		got.push_back(*i);
+		got.push_back(sel.template take<1>());
+	};
+
+	// The arm of qb is reused in each round; it takes one item per round.
+	for (int k = 0; k < 3; k++) {
+		coro(sel, got);
+		int items[2] = {2 * k, 2 * k + 1};
+		qb.put_range(items);
+		ASSERT_EQ(got, (std::vector<int>{1, 2 * k}));
+		ASSERT_EQ(qb.maybe_get(), 2 * k + 1);
+		ASSERT_TRUE(qb.empty());
+		got.clear();
+	}
+
+	// Inserting no items does not fire the arm.
+	coro(sel, got);
+	qb.put_range({});
+	ASSERT_TRUE(got.empty());
+	int item = 42;
+	qb.put_range({&item, 1});
+	ASSERT_EQ(got, (std::vector<int>{1, 42}));
+
+	// The arm of qa is dropped once items arrive while no async_select() is pending.
+	int items[2] = {10, 11};
+	qa.put_range(items);
+	ASSERT_EQ(qa.maybe_get(), 10);
+	ASSERT_EQ(qa.maybe_get(), 11);
+}
+
+TEST(Select, Events) {
+	queue_type q;
+	async::recurring_event tick;
+	async::oneshot_primitive shutdown;
+	async::selector sel{q, tick, shutdown};
+	std::vector<size_t> got;
+
+	auto coro = [] (auto &sel, async::cancellation_token ct,
+			std::vector<size_t> &got) -> async::detached {
+		auto i = co_await sel.async_select(ct);
+		got.push_back(i ? *i : 99);
+	};
+
+	coro(sel, {}, got);
+	tick.raise();
+	ASSERT_EQ(got, (std::vector<size_t>{1}));
+
+	// Raising the event while no async_select() is pending drops its arm.
+	tick.raise();
+	async::cancellation_event ce;
+	coro(sel, ce, got);
+	ce.cancel();
+	ASSERT_EQ(got, (std::vector<size_t>{1, 99}));
+
+	coro(sel, {}, got);
+	shutdown.raise();
+	ASSERT_EQ(got, (std::vector<size_t>{1, 99, 2}));
+
+	// The oneshot_primitive stays raised.
+	q.put(1);
+	coro(sel, {}, got);
+	ASSERT_EQ(got, (std::vector<size_t>{1, 99, 2, 0}));
+	coro(sel, {}, got);
+	ASSERT_EQ(got, (std::vector<size_t>{1, 99, 2, 0, 2}));
+}
+
+TEST(Select, DestroyBeforeRaise) {
+	queue_type q;
+	async::recurring_event tick;
+	async::oneshot_primitive shutdown;
+
+	{
+		async::selector sel{q, tick, shutdown};
+		size_t got = 0;
+		auto coro = [] (auto &sel, size_t &got) -> async::detached {
+			got = *(co_await sel.async_select());
+		};
+		coro(sel, got);
+		q.put(1);
+		ASSERT_EQ(got, 0);
+		ASSERT_EQ(sel.take<0>(), 1);
+	}
+
+	// The arms of the selector were unlinked.
+	q.put(2);
+	tick.raise();
+	shutdown.raise();
+	ASSERT_EQ(q.maybe_get(), 2);
+}
+
+TEST(Select, Threads) {
+	using selector_type = async::selector<queue_type, queue_type, async::oneshot_primitive>;
+	queue_type qa;
+	queue_type qb;
+	async::oneshot_primitive shutdown;
+	constexpr int num_items = 5000;
+
+	struct select_receiver {
+		void set_value(frg::optional<size_t> i) {
+			auto f = flag; // The operation may be gone after the store.
+			*out = *i;
+			f->store(true, std::memory_order_release);
+			f->notify_one();
+		}
+
+		std::atomic<bool> *flag;
+		size_t *out;
+	};
+
+	std::thread consumer{[&] {
+		selector_type sel{qa, qb, shutdown};
+		int expected[2] = {0, 0};
+		std::atomic<bool> done;
+		while (true) {
+			size_t i;
+			done.store(false, std::memory_order_relaxed);
+			auto op = async::execution::connect(sel.async_select(),
+					select_receiver{&done, &i});
+			async::execution::start(op);
+			done.wait(false, std::memory_order_acquire);
+
+			if (i == 2)
+				break;
+			// Items of each queue arrive in FIFO order.
+			auto item = i == 0 ? sel.take<0>() : sel.take<1>();
+			EXPECT_EQ(item, expected[i]++);
+		}
+
+		// The shutdown event can win even if items are left.
+		while (auto item = qa.maybe_get())
+			EXPECT_EQ(*item, expected[0]++);
+		while (auto item = qb.maybe_get())
+			EXPECT_EQ(*item, expected[1]++);
+		EXPECT_EQ(expected[0], num_items);
+		EXPECT_EQ(expected[1], num_items);
+	}};
+
+	std::thread other{[&] {
+		for (int i = 0; i < num_items; i++)
+			qb.put(i);
+	}};
+	for (int i = 0; i < num_items; i++)
+		qa.put(i);
+	other.join();
+
+	shutdown.raise();
+	consumer.join();
+}
@@ -0,0 +1,76 @@
+#include <async/semaphore.hpp>
+#include <async/result.hpp>
+#include <gtest/gtest.h>
+
+TEST(Semaphore, TryAcquire) {
+	async::semaphore sem{2};
+
+	ASSERT_TRUE(sem.try_acquire());
+	ASSERT_FALSE(sem.try_acquire(2));
+	ASSERT_TRUE(sem.try_acquire());
+	ASSERT_FALSE(sem.try_acquire());
+	sem.release(2);
+	ASSERT_TRUE(sem.try_acquire(2));
+}
+
+TEST(Semaphore, WeightedFifo) {
+	async::semaphore sem{0};
+	int order[3] = {};
+	int n = 0;
+
+	auto coro = [] (async::semaphore &sem, size_t units, int id, int *order, int &n)
+			-> async::detached {
+		auto success = co_await sem.async_acquire(units);
+		EXPECT_TRUE(success);
+		order[n++] = id;
+	};
+
+	coro(sem, 3, 1, order, n);
+	coro(sem, 1, 2, order, n);
+	coro(sem, 2, 3, order, n);
+
+	// The second waiter must not overtake the first one.
+	sem.release(1);
+	ASSERT_EQ(n, 0);
+	ASSERT_FALSE(sem.try_acquire());
+
+	sem.release(2);
+	ASSERT_EQ(n, 1);
+	ASSERT_EQ(order[0], 1);
+
+	sem.release(1);
+	ASSERT_EQ(n, 2);
+	ASSERT_EQ(order[1], 2);
+
+	sem.release(2);
+	ASSERT_EQ(n, 3);
+	ASSERT_EQ(order[2], 3);
+	ASSERT_FALSE(sem.try_acquire());
+}
+
+TEST(Semaphore, Cancel) {
+	async::semaphore sem{1};
+	async::cancellation_event ce;
+	bool big_acquired = true;
+	bool small_acquired = false;
+
+	auto big = [] (async::semaphore &sem, async::cancellation_token ct, bool &acquired)
+			-> async::detached {
+		acquired = co_await sem.async_acquire(2, ct);
+	};
+	auto small = [] (async::semaphore &sem, bool &acquired) -> async::detached {
+		acquired = co_await sem.async_acquire(1);
+	};
+
+	big(sem, ce, big_acquired);
+	small(sem, small_acquired);
+	ASSERT_FALSE(small_acquired);
+
+	// Cancelling the front waiter unblocks the waiter behind it.
+	ce.cancel();
+	ASSERT_FALSE(big_acquired);
+	ASSERT_TRUE(small_acquired);
+
+	sem.release(1);
+	ASSERT_TRUE(sem.try_acquire());
+}
@@ -0,0 +1,103 @@
+#include <atomic>
+#include <thread>
+
+#include <async/spsc-queue.hpp>
+#include <async/result.hpp>
+#include <gtest/gtest.h>
+
+namespace {
+
+struct get_receiver {
+	void set_value(frg::optional<int> v) {
+		auto f = flag; // The operation may be gone after the store.
+		*out = v ? *v : -1;
+		f->store(true, std::memory_order_release);
+		f->notify_one();
+	}
+
+	std::atomic<bool> *flag;
+	int *out;
+};
+
+} // anonymous namespace
+
+TEST(SpscQueue, TryPut) {
+	async::spsc_queue<int, 4> q;
+
+	for (int i = 0; i < 4; i++)
+		ASSERT_TRUE(q.try_put(i));
+	ASSERT_FALSE(q.try_put(4));
+
+	ASSERT_EQ(*q.maybe_get(), 0);
+	ASSERT_TRUE(q.try_put(4));
+	for (int i = 1; i < 5; i++)
+		ASSERT_EQ(*q.maybe_get(), i);
+	ASSERT_FALSE(q.maybe_get());
+}
+
+TEST(SpscQueue, AsyncGet) {
+	async::spsc_queue<int, 4> q;
+	int got = 0;
+
+	auto coro = [] (async::spsc_queue<int, 4> &q, int &got) -> async::detached {
+		got = *(co_await q.async_get());
+	};
+
+	coro(q, got);
+	ASSERT_EQ(got, 0);
+	ASSERT_TRUE(q.try_put(1));
+	ASSERT_EQ(got, 1);
+
+	// Items that are already in the queue are returned immediately.
+	ASSERT_TRUE(q.try_put(2));
+	coro(q, got);
+	ASSERT_EQ(got, 2);
+}
+
+TEST(SpscQueue, Cancel) {
+	async::spsc_queue<int, 4> q;
+	async::cancellation_event ce;
+	frg::optional<int> result{0};
+	bool done = false;
+
+	auto coro = [] (async::spsc_queue<int, 4> &q, async::cancellation_token ct,
+			frg::optional<int> &result, bool &done) -> async::detached {
+		result = co_await q.async_get(ct);
+		done = true;
+	};
+
+	coro(q, ce, result, done);
+	ASSERT_FALSE(done);
+	ce.cancel();
+	ASSERT_TRUE(done);
+	ASSERT_FALSE(result);
+
+	// The cancelled operation does not take any items.
+	ASSERT_TRUE(q.try_put(1));
+	ASSERT_EQ(*q.maybe_get(), 1);
+}
+
+TEST(SpscQueue, Threads) {
+	async::spsc_queue<int, 16> q;
+	constexpr int num_items = 50000;
+
+	std::thread producer{[&] {
+		for (int i = 1; i <= num_items; i++) {
+			while (!q.try_put(i))
+				std::this_thread::yield();
+		}
+	}};
+
+	std::atomic<bool> done;
+	int value;
+	for (int i = 1; i <= num_items; i++) {
+		done.store(false, std::memory_order_relaxed);
+		auto op = async::execution::connect(q.async_get(), get_receiver{&done, &value});
+		async::execution::start(op);
+		done.wait(false, std::memory_order_acquire);
+		ASSERT_EQ(value, i);
+	}
+
+	producer.join();
+	ASSERT_FALSE(q.maybe_get());
+}
@@ -0,0 +1,122 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <async/watch.hpp>
+#include <async/result.hpp>
+#include <gtest/gtest.h>
+
+#include <frg/std_compat.hpp>
+
+TEST(Watch, Snapshots) {
+	async::watch<std::string, frg::stl_allocator> w{"initial"};
+
+	auto [seq, value] = w.current();
+	ASSERT_EQ(seq, 0);
+	ASSERT_EQ(*value, "initial");
+
+	w.set("first");
+	w.emplace(3, 'x');
+
+	// Readers keep their snapshots across updates.
+	ASSERT_EQ(*value, "initial");
+	auto u = w.current();
+	ASSERT_EQ(u.seq, 2);
+	ASSERT_EQ(*u.value, "xxx");
+}
+
+TEST(Watch, Changed) {
+	async::watch<int, frg::stl_allocator> w{0};
+	std::vector<int> got;
+
+	auto reader = [] (async::watch<int, frg::stl_allocator> &w, uint64_t seq,
+			async::cancellation_token ct, std::vector<int> &got) -> async::detached {
+		auto u = co_await w.async_changed(seq, ct);
+		got.push_back(u.seq);
+		got.push_back(*u.value);
+	};
+
+	reader(w, 0, {}, got);
+	ASSERT_TRUE(got.empty());
+	w.set(42);
+	ASSERT_EQ(got, (std::vector<int>{1, 42}));
+
+	// Stale sequence numbers complete immediately.
+	reader(w, 0, {}, got);
+	ASSERT_EQ(got, (std::vector<int>{1, 42, 1, 42}));
+
+	// Cancellation returns the current value.
+	async::cancellation_event ce;
+	reader(w, 1, ce, got);
+	ce.cancel();
+	ASSERT_EQ(got, (std::vector<int>{1, 42, 1, 42, 1, 42}));
+}
+
+TEST(Watch, Threads) {
+	using watch_type = async::watch<int, frg::stl_allocator>;
+	watch_type w{0};
+	constexpr int num_updates = 5000;
+
+	struct update_receiver {
+		void set_value(watch_type::update u) {
+			auto f = flag; // The operation may be gone after the store.
+			*out = std::move(u);
+			f->store(true, std::memory_order_release);
+			f->notify_one();
+		}
+
+		std::atomic<bool> *flag;
+		watch_type::update *out;
+	};
+
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 3; t++) {
+		readers.emplace_back([&] {
+			auto u = w.current();
+			std::atomic<bool> done;
+			while (*u.value != num_updates) {
+				watch_type::update next;
+				done.store(false, std::memory_order_relaxed);
+				auto op = async::execution::connect(w.async_changed(u.seq),
+						update_receiver{&done, &next});
+				async::execution::start(op);
+				done.wait(false, std::memory_order_acquire);
+
+				// Values only move forward.
+				EXPECT_GT(next.seq, u.seq);
+				EXPECT_GT(*next.value, *u.value);
+				u = std::move(next);
+			}
+		});
+	}
+
+	for (int i = 1; i <= num_updates; i++)
+		w.set(i);
+	for (auto &thread : readers)
+		thread.join();
+}
+
+TEST(Watch, PollCurrent) {
+	async::watch<std::string, frg::stl_allocator> w{"0"};
+	constexpr int num_updates = 20000;
+
+	// current() races with the pointer swap in set().
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 3; t++) {
+		readers.emplace_back([&] {
+			uint64_t last = 0;
+			while (last != num_updates) {
+				auto [seq, value] = w.current();
+				EXPECT_GE(seq, last);
+				EXPECT_EQ(*value, std::to_string(seq));
+				last = seq;
+			}
+		});
+	}
+
+	for (int i = 1; i <= num_updates; i++)
+		w.set(std::to_string(i));
+	for (auto &thread : readers)
+		thread.join();
+}